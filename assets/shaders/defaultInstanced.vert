@@ -0,0 +1,19 @@
+#version 460 core
+layout(location = 0) in vec3 aPos;
+layout(location = 2) in vec2 aTexCoord;
+// Per instance; a mat4 takes locations 4 to 7
+layout(location = 4) in mat4 aModel;
+
+layout(std140, binding = 0) uniform uniformManager {
+  mat4 uCameraView;
+  mat4 uCameraProjection;
+  float uDeltatime;
+  float uTime;
+};
+
+out vec2 TexCoord;
+
+void main() {
+  gl_Position = uCameraProjection * uCameraView * aModel * vec4(aPos, 1.0);
+  TexCoord = aTexCoord;
+}
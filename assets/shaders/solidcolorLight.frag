@@ -4,8 +4,8 @@ out vec4 FragColor;
 in vec3 vNormal;
 in vec3 vWorldPos;
 in vec2 vTexCoord;
+in vec3 vColor; // Per draw, or per instance in the instanced variant
 
-uniform vec3 uColor; 
 uniform vec3 uViewPos;
 uniform sampler2D uDiffuseMap; // Optional: for future texture support
 uniform bool uUseTexture;
@@ -33,7 +33,7 @@ void main() {
     vec3 viewDir = normalize(uViewPos - vWorldPos);
     
     // Determine base color (Texture or Solid Color)
-    vec3 baseColor = uColor;
+    vec3 baseColor = vColor;
     if(uUseTexture) {
         baseColor *= texture(uDiffuseMap, vTexCoord).rgb;
     }
@@ -6,8 +6,10 @@ layout(location = 2) in vec2 aTexCoord; // Added UVs
 out vec3 vNormal;
 out vec3 vWorldPos;
 out vec2 vTexCoord; // Pass to frag
+out vec3 vColor;
 
 uniform mat4 uModel;
+uniform vec3 uColor;
 
 layout(std140, binding = 0) uniform uniformManager {
     mat4 uCameraView;
@@ -21,6 +23,7 @@ void main() {
     vWorldPos = worldPos.xyz;
     vNormal = mat3(transpose(inverse(uModel))) * aNormal;
     vTexCoord = aTexCoord;
+    vColor = uColor;
 
     gl_Position = uCameraProjection * uCameraView * worldPos;
 }
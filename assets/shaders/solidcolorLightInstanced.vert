@@ -0,0 +1,29 @@
+#version 460 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord; // Added UVs
+// Per instance; a mat4 takes locations 4 to 7
+layout(location = 4) in mat4 aModel;
+layout(location = 8) in vec3 aColor;
+
+out vec3 vNormal;
+out vec3 vWorldPos;
+out vec2 vTexCoord; // Pass to frag
+out vec3 vColor;
+
+layout(std140, binding = 0) uniform uniformManager {
+    mat4 uCameraView;
+    mat4 uCameraProjection;
+    float uDeltatime;
+    float uTime;
+};
+
+void main() {
+    vec4 worldPos = aModel * vec4(aPos, 1.0);
+    vWorldPos = worldPos.xyz;
+    vNormal = mat3(transpose(inverse(aModel))) * aNormal;
+    vTexCoord = aTexCoord;
+    vColor = aColor;
+
+    gl_Position = uCameraProjection * uCameraView * worldPos;
+}
@@ -36,6 +36,34 @@ Shader &AssetManager::loadShader(const std::string &name,
   return it->second;
 }
 
+Shader &AssetManager::loadInstancedShader(const std::string &name,
+                                          const std::string &vertPath,
+                                          const std::string &fragPath) {
+  Shader &shader = getShader(name);
+  if (!shader.instanced) {
+    Shader &variant = loadShader(name + ".instanced", vertPath, fragPath);
+    if (variant.linked()) {
+      shader.instanced = &variant;
+    } else {
+      Logger::Warn("Instanced shader \"%s\" failed to link", name.c_str());
+    }
+    return variant;
+  }
+  return *shader.instanced;
+}
+
+Shader &AssetManager::loadComputeShader(const std::string &name,
+                                        const std::string &path) {
+  auto it = shaders.find(name);
+  Logger::Debug("Loading compute shader \"%s\"", name.c_str());
+
+  if (it == shaders.end()) {
+    auto [newIt, success] = shaders.emplace(name, Shader(path.c_str()));
+    return newIt->second;
+  }
+  return it->second;
+}
+
 Shader &AssetManager::getShader(const std::string &name) {
   return shaders.at(name);
 }
@@ -98,37 +126,7 @@ Mesh &AssetManager::loadMesh(const std::string &name, const char *path) {
     }
   }
 
-  unsigned int VAO, VBO, EBO;
-  glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
-  glGenBuffers(1, &EBO);
-
-  glBindVertexArray(VAO);
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
-               vertices.data(), GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-               indices.data(), GL_STATIC_DRAW);
-
-  // vertex positions
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-                        MESH_VERTEX_SIZE * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
-  // vertex normals
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-                        MESH_VERTEX_SIZE * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-  // texcoords
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-                        MESH_VERTEX_SIZE * sizeof(float),
-                        (void *)(6 * sizeof(float)));
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE,
-                        MESH_VERTEX_SIZE * sizeof(float),
-                        (void *)(8 * sizeof(float)));
-  glEnableVertexAttribArray(3);
+  MeshBuffer::Range range = meshBuffer.add(vertices, indices);
 
   unsigned int suggestedDrawMode = GL_TRIANGLES;
 
@@ -167,12 +165,13 @@ Mesh &AssetManager::loadMesh(const std::string &name, const char *path) {
     };
   }
 
-  Mesh mesh{VAO,
-            VBO,
-            EBO,
+  Mesh mesh{meshBuffer.getVAO(),
             static_cast<unsigned int>(indices.size()),
             suggestedDrawMode,
-            meshTextures};
+            meshTextures,
+            range.baseVertex,
+            range.firstIndex,
+            Bounds::of(vertices, MESH_VERTEX_SIZE)};
   meshes[name] = mesh;
   return meshes[name];
 }
@@ -182,3 +181,4 @@ Mesh &AssetManager::getMesh(const std::string &name) { return meshes.at(name); }
 std::map<std::string, Texture> AssetManager::textures;
 std::map<std::string, Shader> AssetManager::shaders;
 std::map<std::string, Mesh> AssetManager::meshes;
+MeshBuffer AssetManager::meshBuffer;
@@ -1,20 +1,23 @@
 #pragma once
 
+#include "assets/meshBuffer.hpp"
+#include "platform/rendering/bounds.hpp"
 #include "platform/rendering/shader.hpp"
 #include "platform/rendering/texture.hpp"
 #include "tiny_obj_loader.h"
 #include <map>
 #include <string>
 
-const int MESH_VERTEX_SIZE = 11;
-
+// A mesh lives in AssetManager::meshBuffer: VAO is shared by every mesh
+// and indices [firstIndex, firstIndex + indexCount) are its own
 struct Mesh {
   unsigned int VAO;
-  unsigned int VBO;
-  unsigned int EBO;
   unsigned int indexCount;
   unsigned int suggestedDrawMode;
   std::vector<Texture *> textures;
+  int baseVertex;
+  unsigned int firstIndex;
+  Bounds bounds; // In the mesh's own space
 };
 
 class AssetManager {
@@ -26,6 +29,14 @@ public:
   static Shader &loadShader(const std::string &name,
                             const std::string &vertPath,
                             const std::string &fragPath);
+  // Loads the instanced variant of an already loaded shader; it shares the
+  // fragment shader. A variant that fails to link is not attached.
+  static Shader &loadInstancedShader(const std::string &name,
+                                     const std::string &vertPath,
+                                     const std::string &fragPath);
+  // Needs compute shader support (gl4::computeShaders)
+  static Shader &loadComputeShader(const std::string &name,
+                                   const std::string &path);
   static Shader &getShader(const std::string &name);
 
   // Meshes
@@ -38,4 +49,5 @@ public:
   static std::map<std::string, Texture> textures;
   static std::map<std::string, Shader> shaders;
   static std::map<std::string, Mesh> meshes;
+  static MeshBuffer meshBuffer;
 };
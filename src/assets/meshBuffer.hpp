@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <glad/glad.h>
+#include <span>
+#include <stdexcept>
+
+const int MESH_VERTEX_SIZE = 11; // Floats: position, normal, uv, colour
+
+// Every static mesh in one vertex buffer and one index buffer behind a
+// single VAO, so switching meshes needs no binds and whole passes can be
+// submitted with one multi-draw. Meshes are appended and addressed by their
+// base vertex and first index. When a buffer fills up it is copied into one
+// twice the size on the GPU; the VAO stays the same.
+//
+// GL objects are created on the first add(), once a context exists, and
+// live as long as the process like the other assets.
+class MeshBuffer {
+public:
+  struct Range {
+    GLint baseVertex;  // Added to every index of the mesh
+    GLuint firstIndex; // Offset of its first index, in indices
+  };
+
+  // vertices holds MESH_VERTEX_SIZE floats per vertex; indices are local to
+  // the mesh
+  Range add(std::span<const float> vertices,
+            std::span<const unsigned int> indices) {
+    if (vertices.size() % MESH_VERTEX_SIZE != 0) {
+      throw std::invalid_argument("Vertex data is not whole vertices");
+    }
+    if (!vao) {
+      glGenVertexArrays(1, &vao);
+    }
+    size_t vertexCount = vertices.size() / MESH_VERTEX_SIZE;
+    bool grown = grow(vbo, vertexCapacity, vertexUsed,
+                      vertexUsed + vertexCount, VERTEX_BYTES);
+    grown |= grow(ebo, indexCapacity, indexUsed, indexUsed + indices.size(),
+                  sizeof(unsigned int));
+    if (grown) {
+      bindLayout();
+    }
+
+    Range range{static_cast<GLint>(vertexUsed),
+                static_cast<GLuint>(indexUsed)};
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, vertexUsed * VERTEX_BYTES,
+                    vertices.size_bytes(), vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // The element buffer binding is VAO state, so go through the VAO
+    glBindVertexArray(vao);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                    indexUsed * sizeof(unsigned int), indices.size_bytes(),
+                    indices.data());
+    glBindVertexArray(0);
+
+    vertexUsed += vertexCount;
+    indexUsed += indices.size();
+    return range;
+  }
+
+  GLuint getVAO() const { return vao; }
+
+private:
+  static constexpr size_t VERTEX_BYTES = MESH_VERTEX_SIZE * sizeof(float);
+  static constexpr size_t MIN_CAPACITY = 1 << 16; // In vertices or indices
+
+  // Makes buffer hold at least `needed` elements, keeping the first `used`.
+  // Returns true if the buffer object changed.
+  bool grow(GLuint &buffer, size_t &capacity, size_t used, size_t needed,
+            size_t elementBytes) {
+    if (needed <= capacity)
+      return false;
+    capacity = std::max({needed, capacity * 2, MIN_CAPACITY});
+
+    GLuint bigger;
+    glGenBuffers(1, &bigger);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bigger);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity * elementBytes, nullptr,
+                 GL_STATIC_DRAW);
+    if (buffer) {
+      glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                          used * elementBytes);
+      glBindBuffer(GL_COPY_READ_BUFFER, 0);
+      glDeleteBuffers(1, &buffer);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffer = bigger;
+    return true;
+  }
+
+  // Points the VAO at the current buffers
+  void bindLayout() {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+
+    // vertex positions
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTES, (void *)0);
+    glEnableVertexAttribArray(0);
+    // vertex normals
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTES,
+                          (void *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    // texcoords
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, VERTEX_BYTES,
+                          (void *)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    // vertex colours
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, VERTEX_BYTES,
+                          (void *)(8 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  GLuint vao = 0;
+  GLuint vbo = 0;
+  GLuint ebo = 0;
+  size_t vertexCapacity = 0; // In vertices
+  size_t indexCapacity = 0;  // In indices
+  size_t vertexUsed = 0;
+  size_t indexUsed = 0;
+};
@@ -0,0 +1,86 @@
+// Shared by the benchmark binaries: heap accounting and JSON output
+#include "bench/bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <random>
+
+namespace {
+
+// Heap accounting for bytes-per-entity. Counts usable size, so allocator
+// rounding is included the same way for every implementation.
+std::atomic<size_t> heapBytes{0};
+
+void *track(void *p) {
+  if (!p)
+    throw std::bad_alloc();
+  heapBytes += malloc_usable_size(p);
+  return p;
+}
+
+void untrack(void *p) {
+  if (p) {
+    heapBytes -= malloc_usable_size(p);
+    std::free(p);
+  }
+}
+
+void *alignedAlloc(size_t size, std::align_val_t align) {
+  size_t alignment = static_cast<size_t>(align);
+  return std::aligned_alloc(alignment,
+                            (size + alignment - 1) & ~(alignment - 1));
+}
+
+} // namespace
+
+void *operator new(size_t size) { return track(std::malloc(size)); }
+void *operator new[](size_t size) { return track(std::malloc(size)); }
+void *operator new(size_t size, std::align_val_t align) {
+  return track(alignedAlloc(size, align));
+}
+void *operator new[](size_t size, std::align_val_t align) {
+  return track(alignedAlloc(size, align));
+}
+void operator delete(void *p) noexcept { untrack(p); }
+void operator delete[](void *p) noexcept { untrack(p); }
+void operator delete(void *p, size_t) noexcept { untrack(p); }
+void operator delete[](void *p, size_t) noexcept { untrack(p); }
+void operator delete(void *p, std::align_val_t) noexcept { untrack(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { untrack(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  untrack(p);
+}
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  untrack(p);
+}
+
+size_t liveHeapBytes() { return heapBytes.load(); }
+
+std::vector<size_t> shuffledOrder(size_t count) {
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937_64(1938));
+  return order;
+}
+
+void printResults(const std::vector<BenchResult> &results) {
+  std::printf("{\n  \"results\": [\n");
+  for (size_t r = 0; r < results.size(); r++) {
+    const BenchResult &result = results[r];
+    std::printf("    {\"impl\": \"%s\", \"entities\": %zu, "
+                "\"bytes_per_entity\": %.1f, \"ns_per_op\": {",
+                result.impl.c_str(), result.entities, result.bytesPerEntity);
+    for (size_t i = 0; i < result.nsPerOp.size(); i++) {
+      std::printf("%s\"%s\": %.2f", i ? ", " : "",
+                  result.nsPerOp[i].first.c_str(), result.nsPerOp[i].second);
+    }
+    std::printf("}}%s\n", r + 1 < results.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Entity counts every benchmark runs at
+inline constexpr size_t BENCH_SIZES[] = {10'000, 100'000, 1'000'000};
+
+// Results for one implementation at one entity count
+struct BenchResult {
+  std::string impl;
+  size_t entities = 0;
+  double bytesPerEntity = 0.0; // Heap held by the world after setup
+  std::vector<std::pair<std::string, double>> nsPerOp;
+};
+
+// Bytes currently allocated through operator new, tracked in bench.cpp
+size_t liveHeapBytes();
+
+// Prints results as one JSON document to stdout
+void printResults(const std::vector<BenchResult> &results);
+
+class BenchTimer {
+public:
+  BenchTimer() : start(std::chrono::steady_clock::now()) {}
+
+  double nsPer(size_t ops) const {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() /
+           static_cast<double>(ops);
+  }
+
+private:
+  std::chrono::steady_clock::time_point start;
+};
+
+// Keeps the optimizer from discarding a computed value
+template <typename T> inline void doNotOptimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Entity order for the random access benchmark, identical across impls
+std::vector<size_t> shuffledOrder(size_t count);
+
+void runEcsBench(size_t entities, std::vector<BenchResult> &results);
+void runEcs2Bench(size_t entities, std::vector<BenchResult> &results);
+void runCullBench(size_t entities, std::vector<BenchResult> &results);
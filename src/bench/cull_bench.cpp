@@ -0,0 +1,63 @@
+#include "bench/bench.hpp"
+#include "platform/rendering/frustum.hpp"
+
+#include <random>
+
+namespace {
+
+// Looks down -z from the origin like Camera3D does, 75 degree fov
+Frustum benchFrustum() {
+  const float near = 0.01f, far = 100.0f;
+  const float t = std::tan(glm::radians(75.0f) * 0.5f), aspect = 16.0f / 9;
+  glm::mat4 projection(0.0f);
+  projection[0][0] = 1.0f / (aspect * t);
+  projection[1][1] = 1.0f / t;
+  projection[2][2] = -(far + near) / (far - near);
+  projection[2][3] = -1.0f;
+  projection[3][2] = -2.0f * far * near / (far - near);
+  return Frustum::fromMatrix(projection);
+}
+
+} // namespace
+
+void runCullBench(size_t entities, std::vector<BenchResult> &results) {
+  BenchResult result{"frustum", entities, 0.0, {}};
+
+  // Unit cubes scattered around the camera, so most of them are culled
+  std::mt19937 rng(1938);
+  std::uniform_real_distribution<float> spread(-120.0f, 120.0f);
+  std::vector<glm::mat4> models(entities, glm::mat4(1.0f));
+  for (glm::mat4 &model : models) {
+    model[3] = glm::vec4(spread(rng), spread(rng), spread(rng), 1.0f);
+  }
+  Bounds cube;
+  cube.min = glm::vec3(-0.5f);
+  cube.max = glm::vec3(0.5f);
+  cube.radius = 0.87f;
+
+  size_t heapBefore = liveHeapBytes();
+  BoxSet boxes;
+  boxes.reserve(entities);
+  std::vector<uint32_t> visible(entities);
+
+  BenchTimer push;
+  for (const glm::mat4 &model : models) {
+    boxes.push(cube, model);
+  }
+  result.nsPerOp.push_back({"bounds", push.nsPer(entities)});
+  result.bytesPerEntity =
+      static_cast<double>(liveHeapBytes() - heapBefore) / entities;
+
+  Frustum frustum = benchFrustum();
+  const size_t rounds = 16;
+  size_t kept = 0;
+  BenchTimer cull;
+  for (size_t r = 0; r < rounds; r++) {
+    kept += frustum.cull(boxes, visible.data());
+    doNotOptimize(visible[0]);
+  }
+  doNotOptimize(kept);
+  result.nsPerOp.push_back({"cull", cull.nsPer(entities * rounds)});
+
+  results.push_back(std::move(result));
+}
@@ -0,0 +1,13 @@
+// Frustum culling microbenchmark. Needs glm like the app does, so it is
+// built apart from the ECS benchmarks. Prints one JSON document to stdout:
+//   make cull-bench > cull.json
+#include "bench/bench.hpp"
+
+int main() {
+  std::vector<BenchResult> results;
+  for (size_t entities : BENCH_SIZES) {
+    runCullBench(entities, results);
+  }
+  printResults(results);
+  return 0;
+}
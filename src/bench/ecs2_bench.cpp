@@ -0,0 +1,106 @@
+#include "bench/bench.hpp"
+#include "engine/ecs2.hpp"
+
+namespace {
+
+// One component pair per storage backend so every backend is measured with
+// identical data in the same process
+template <StorageMode Mode> struct Position {
+  float x, y, z;
+};
+
+template <StorageMode Mode> struct Velocity {
+  float x, y, z;
+};
+
+} // namespace
+
+template <StorageMode Mode> struct ComponentStorage<Position<Mode>> {
+  static constexpr StorageMode mode = Mode;
+};
+
+template <StorageMode Mode> struct ComponentStorage<Velocity<Mode>> {
+  static constexpr StorageMode mode = Mode;
+};
+
+namespace {
+
+template <StorageMode Mode>
+void runWorld(const char *impl, size_t entities,
+              std::vector<BenchResult> &results) {
+  using P = Position<Mode>;
+  using V = Velocity<Mode>;
+
+  BenchResult result{impl, entities, 0.0, {}};
+  size_t heapBefore = liveHeapBytes();
+
+  {
+    ECS2 world;
+    std::vector<Entity> ids(entities);
+
+    BenchTimer create;
+    for (size_t i = 0; i < entities; i++) {
+      ids[i] = world.createEntity();
+    }
+    result.nsPerOp.push_back({"create", create.nsPer(entities)});
+
+    // Every entity gets a Position, every other one a Velocity
+    size_t adds = 0;
+    BenchTimer add;
+    for (size_t i = 0; i < entities; i++) {
+      world.addComponent(ids[i], P{float(i), 0.0f, 0.0f});
+      adds++;
+      if (i % 2 == 0) {
+        world.addComponent(ids[i], V{1.0f, 1.0f, 1.0f});
+        adds++;
+      }
+    }
+    result.nsPerOp.push_back({"add", add.nsPer(adds)});
+
+    // Warm the cached queries so their memory is counted and their one-off
+    // construction is not timed
+    world.view<const P>().each([](Entity, const P &) {});
+    world.view<P, const V>().each([](Entity, P &, const V &) {});
+    result.bytesPerEntity =
+        double(liveHeapBytes() - heapBefore) / double(entities);
+
+    BenchTimer single;
+    float sum = 0.0f;
+    world.view<const P>().each([&](Entity, const P &p) { sum += p.x; });
+    doNotOptimize(sum);
+    result.nsPerOp.push_back({"query_single", single.nsPer(entities)});
+
+    BenchTimer multi;
+    world.view<P, const V>().each([](Entity, P &p, const V &v) {
+      p.x += v.x;
+      p.y += v.y;
+      p.z += v.z;
+    });
+    result.nsPerOp.push_back({"query_multi", multi.nsPer(entities / 2)});
+
+    std::vector<size_t> order = shuffledOrder(entities);
+    BenchTimer random;
+    sum = 0.0f;
+    for (size_t i : order) {
+      sum += world.getComponent<const P>(ids[i]).x;
+    }
+    doNotOptimize(sum);
+    result.nsPerOp.push_back({"get_random", random.nsPer(entities)});
+
+    BenchTimer remove;
+    for (size_t i = 0; i < entities; i += 2) {
+      world.removeComponent<V>(ids[i]);
+    }
+    result.nsPerOp.push_back({"remove", remove.nsPer((entities + 1) / 2)});
+  }
+
+  results.push_back(std::move(result));
+}
+
+} // namespace
+
+void runEcs2Bench(size_t entities, std::vector<BenchResult> &results) {
+  runWorld<StorageMode::Map>("ecs2-map", entities, results);
+  runWorld<StorageMode::SparseSet>("ecs2-sparse", entities, results);
+  runWorld<StorageMode::Archetype>("ecs2-archetype", entities, results);
+}
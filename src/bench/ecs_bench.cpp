@@ -0,0 +1,86 @@
+#include "bench/bench.hpp"
+#include "engine/ecs.hpp"
+
+namespace {
+
+struct Position {
+  float x, y, z;
+};
+
+struct Velocity {
+  float x, y, z;
+};
+
+} // namespace
+
+// The original ECS: an entity counter plus one hash map per component type
+void runEcsBench(size_t entities, std::vector<BenchResult> &results) {
+  BenchResult result{"ecs", entities, 0.0, {}};
+  size_t heapBefore = liveHeapBytes();
+
+  {
+    ECS ecs;
+    ComponentStore<Position> positions;
+    ComponentStore<Velocity> velocities;
+    std::vector<Entity> ids(entities);
+
+    BenchTimer create;
+    for (size_t i = 0; i < entities; i++) {
+      ids[i] = ecs.createEntity();
+    }
+    result.nsPerOp.push_back({"create", create.nsPer(entities)});
+
+    // Every entity gets a Position, every other one a Velocity
+    size_t adds = 0;
+    BenchTimer add;
+    for (size_t i = 0; i < entities; i++) {
+      Position p{float(i), 0.0f, 0.0f};
+      positions.add(ids[i], p);
+      adds++;
+      if (i % 2 == 0) {
+        Velocity v{1.0f, 1.0f, 1.0f};
+        velocities.add(ids[i], v);
+        adds++;
+      }
+    }
+    result.nsPerOp.push_back({"add", add.nsPer(adds)});
+    result.bytesPerEntity =
+        double(liveHeapBytes() - heapBefore) / double(entities);
+
+    BenchTimer single;
+    float sum = 0.0f;
+    for (auto &[e, p] : positions.all()) {
+      sum += p.x;
+    }
+    doNotOptimize(sum);
+    result.nsPerOp.push_back({"query_single", single.nsPer(entities)});
+
+    BenchTimer multi;
+    for (auto &[e, v] : velocities.all()) {
+      if (positions.has(e)) {
+        Position &p = positions.get(e);
+        p.x += v.x;
+        p.y += v.y;
+        p.z += v.z;
+      }
+    }
+    result.nsPerOp.push_back({"query_multi", multi.nsPer(entities / 2)});
+
+    std::vector<size_t> order = shuffledOrder(entities);
+    BenchTimer random;
+    sum = 0.0f;
+    for (size_t i : order) {
+      sum += positions.get(ids[i]).x;
+    }
+    doNotOptimize(sum);
+    result.nsPerOp.push_back({"get_random", random.nsPer(entities)});
+
+    BenchTimer remove;
+    for (size_t i = 0; i < entities; i += 2) {
+      velocities.remove(ids[i]);
+    }
+    result.nsPerOp.push_back({"remove", remove.nsPer((entities + 1) / 2)});
+  }
+
+  results.push_back(std::move(result));
+}
@@ -0,0 +1,13 @@
+// ECS storage microbenchmarks. Prints one JSON document to stdout:
+//   make bench > bench.json
+#include "bench/bench.hpp"
+
+int main() {
+  std::vector<BenchResult> results;
+  for (size_t entities : BENCH_SIZES) {
+    runEcsBench(entities, results);
+    runEcs2Bench(entities, results);
+  }
+  printResults(results);
+  return 0;
+}
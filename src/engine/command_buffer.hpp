@@ -0,0 +1,236 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Stands in for an entity created through a CommandBuffer until the buffer
+// is applied and the real Entity exists
+struct PendingEntity {
+  uint32_t index;
+};
+
+// Records structural changes (create, add, remove, destroy) so they can be
+// made from inside a system or a worker thread and applied later in order.
+// A buffer must only be recorded into by one thread at a time.
+class CommandBuffer {
+public:
+  PendingEntity createEntity() {
+    commands.push_back({CommandType::Create, 0, true, pendingCount, 0});
+    return PendingEntity{pendingCount++};
+  }
+
+  template <typename T> void addComponent(Entity e, T component) {
+    recordAdd(e, false, std::move(component));
+  }
+  template <typename T> void addComponent(PendingEntity e, T component) {
+    recordAdd(e.index, true, std::move(component));
+  }
+
+  template <typename T> void removeComponent(Entity e) {
+    commands.push_back({CommandType::Remove, typedCommands<T>(), false, e, 0});
+  }
+  template <typename T> void removeComponent(PendingEntity e) {
+    commands.push_back(
+        {CommandType::Remove, typedCommands<T>(), true, e.index, 0});
+  }
+
+  void destroyEntity(Entity e) {
+    commands.push_back({CommandType::Destroy, 0, false, e, 0});
+  }
+  void destroyEntity(PendingEntity e) {
+    commands.push_back({CommandType::Destroy, 0, true, e.index, 0});
+  }
+
+  bool empty() const { return commands.empty(); }
+
+  // Replays every command against world in recording order and clears the
+  // buffer. Commands aimed at entities that died in the meantime are
+  // dropped.
+  void apply(ECS2 &world) {
+    resolved.assign(pendingCount, NULL_ENTITY);
+    for (const Command &cmd : commands) {
+      if (cmd.type == CommandType::Create) {
+        resolved[cmd.target] = world.createEntity();
+        continue;
+      }
+
+      Entity e = cmd.pending ? resolved[cmd.target] : cmd.target;
+      if (!world.isAlive(e))
+        continue;
+
+      switch (cmd.type) {
+      case CommandType::Add:
+        typed[cmd.componentId]->add(world, e, cmd.slot);
+        break;
+      case CommandType::Remove:
+        typed[cmd.componentId]->remove(world, e);
+        break;
+      case CommandType::Destroy:
+        world.destroyEntity(e);
+        break;
+      default:
+        break;
+      }
+    }
+    clear();
+  }
+
+  void clear() {
+    commands.clear();
+    for (auto &commandsForType : typed) {
+      if (commandsForType)
+        commandsForType->clear();
+    }
+    pendingCount = 0;
+  }
+
+private:
+  enum class CommandType : uint8_t { Create, Add, Remove, Destroy };
+
+  struct Command {
+    CommandType type;
+    uint8_t componentId;
+    bool pending; // target is a PendingEntity index rather than an Entity
+    uint32_t target;
+    uint32_t slot; // Payload index for Add
+  };
+
+  // Component payloads are kept per type so recording an add is one
+  // push_back into a vector that is reused frame after frame
+  class IComponentCommands {
+  public:
+    virtual ~IComponentCommands() = default;
+    virtual void add(ECS2 &world, Entity e, uint32_t slot) = 0;
+    virtual void remove(ECS2 &world, Entity e) = 0;
+    virtual void clear() = 0;
+  };
+
+  template <typename T> class ComponentCommands : public IComponentCommands {
+  public:
+    std::vector<T> payloads;
+
+    void add(ECS2 &world, Entity e, uint32_t slot) override {
+      world.addComponent<T>(e, std::move(payloads[slot]));
+    }
+    void remove(ECS2 &world, Entity e) override {
+      world.removeComponent<T>(e);
+    }
+    void clear() override { payloads.clear(); }
+  };
+
+  template <typename T> uint8_t typedCommands() {
+    uint8_t id = ComponentTypeManager::getId<T>();
+    if (!typed[id]) {
+      typed[id] = std::make_unique<ComponentCommands<T>>();
+    }
+    return id;
+  }
+
+  template <typename T>
+  void recordAdd(uint32_t target, bool pending, T component) {
+    uint8_t id = typedCommands<T>();
+    auto &payloads = static_cast<ComponentCommands<T> *>(typed[id].get())
+                         ->payloads;
+    commands.push_back({CommandType::Add, id, pending, target,
+                        static_cast<uint32_t>(payloads.size())});
+    payloads.push_back(std::move(component));
+  }
+
+  std::vector<Command> commands;
+  std::unique_ptr<IComponentCommands> typed[MAX_COMPONENTS];
+  uint32_t pendingCount = 0;
+  std::vector<Entity> resolved; // PendingEntity index -> created Entity
+};
+
+class CommandQueue;
+
+// The Scope open on this thread, if any
+struct CommandRecorder {
+  CommandQueue *queue = nullptr;
+  size_t key = 0;
+};
+
+inline thread_local CommandRecorder currentCommandRecorder;
+
+// One CommandBuffer per recorder, merged at a sync point. A recorder is
+// whatever Scope is open on the calling thread, or else the thread itself.
+// flush() applies the buffers in key order and runs as a single ECS2 batch,
+// so cached queries are updated once per touched entity rather than once
+// per command.
+//
+// Scoped keys give the same order every frame however work is spread over
+// threads; the Scheduler uses each system's index. Threads recording outside
+// a scope come after every scoped key, in the order they first asked.
+class CommandQueue {
+public:
+  // Until it ends, local() on this thread returns the buffer for key. Only
+  // one thread at a time may record under a key.
+  class Scope {
+  public:
+    Scope(CommandQueue &queue, size_t key)
+        : previous(currentCommandRecorder) {
+      currentCommandRecorder = {&queue, key};
+    }
+    ~Scope() { currentCommandRecorder = previous; }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    CommandRecorder previous;
+  };
+
+  // The calling recorder's buffer. Safe to call from any thread; recording
+  // into the returned buffer needs no further locking.
+  CommandBuffer &local() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (currentCommandRecorder.queue == this) {
+      return bufferFor(currentCommandRecorder.key);
+    }
+    auto [it, inserted] = threadKeys.try_emplace(
+        std::this_thread::get_id(), UNSCOPED_KEYS + threadKeys.size());
+    return bufferFor(it->second);
+  }
+
+  // Must not overlap with recorders. If a command throws, the commands
+  // before it stay applied and every buffer is cleared, so nothing is
+  // replayed by the next flush.
+  void flush(ECS2 &world) {
+    std::lock_guard<std::mutex> lock(mutex);
+    world.beginBatch();
+    try {
+      for (auto &[key, buffer] : buffers) {
+        buffer->apply(world);
+      }
+    } catch (...) {
+      for (auto &[key, buffer] : buffers) {
+        buffer->clear();
+      }
+      world.endBatch();
+      throw;
+    }
+    world.endBatch();
+  }
+
+private:
+  // Keys handed to threads recording outside a scope start here
+  static constexpr size_t UNSCOPED_KEYS = size_t(1) << 32;
+
+  CommandBuffer &bufferFor(size_t key) {
+    auto &buffer = buffers[key];
+    if (!buffer) {
+      buffer = std::make_unique<CommandBuffer>();
+    }
+    return *buffer;
+  }
+
+  std::mutex mutex;
+  std::map<size_t, std::unique_ptr<CommandBuffer>> buffers; // In apply order
+  std::unordered_map<std::thread::id, size_t> threadKeys;
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <limits>
+#include <vector>
+
+// Spreads the low 10 bits of v so there are two zero bits between each
+inline uint32_t mortonSpread(uint32_t v) {
+  v &= 0x3FF;
+  v = (v | (v << 16)) & 0x030000FF;
+  v = (v | (v << 8)) & 0x0300F00F;
+  v = (v | (v << 4)) & 0x030C30C3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// 30-bit Morton (Z-order) code of a cell on a 1024^3 grid
+inline uint32_t mortonCode(uint32_t x, uint32_t y, uint32_t z) {
+  return mortonSpread(x) | (mortonSpread(y) << 1) | (mortonSpread(z) << 2);
+}
+
+// Reorders the rows of every archetype that stores T by the Morton code of
+// position(T), so entities that are close in space are close in memory and
+// spatial passes (culling, lighting) walk chunks instead of jumping around.
+//
+// The work is incremental: step() does as much as fits in its budget and
+// picks up where it left off next call. Per archetype it finds the bounds,
+// computes codes, radix sorts them in two 15-bit passes and then swaps rows
+// into place one by one. The world may change between steps; entities that
+// died or changed archetype in the meantime are skipped and new ones wait
+// for the next pass. step() must run while nothing else touches the world,
+// e.g. between Scheduler::run() calls.
+template <typename T> class SpatialCompactor {
+  static_assert(isArchetypeStored<T>,
+                "Only archetype rows can be reordered");
+
+public:
+  using PositionFn = glm::vec3 (*)(const T &);
+
+  explicit SpatialCompactor(PositionFn position) : position(position) {}
+
+  // Returns true when this call finished a pass over every archetype
+  bool step(ECS2 &world, std::chrono::microseconds budget) {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    size_t work = 0;
+    // Reading the clock every row would cost more than the rows themselves
+    auto outOfTime = [&] {
+      return ++work % 256 == 0 && std::chrono::steady_clock::now() >= deadline;
+    };
+
+    while (true) {
+      if (phase == Phase::Idle) {
+        if (!nextArchetype(world)) {
+          archetypeCursor = 0;
+          return true;
+        }
+      }
+      // Archetypes are never freed, but one can empty out between steps
+      if (archetype->size() == 0) {
+        phase = Phase::Idle;
+        continue;
+      }
+
+      switch (phase) {
+      case Phase::Bounds:
+        for (; cursor < rows(); cursor++) {
+          if (outOfTime())
+            return false;
+          glm::vec3 p = position(archetype->template get<T>(cursor));
+          low = glm::min(low, p);
+          high = glm::max(high, p);
+        }
+        begin(Phase::Codes);
+        codes.clear();
+        order.clear();
+        break;
+
+      case Phase::Codes: {
+        glm::vec3 extent = high - low;
+        for (; cursor < rows(); cursor++) {
+          if (outOfTime())
+            return false;
+          glm::vec3 p = position(archetype->template get<T>(cursor)) - low;
+          codes.push_back(mortonCode(quantize(p.x, extent.x),
+                                     quantize(p.y, extent.y),
+                                     quantize(p.z, extent.z)));
+          order.push_back(archetype->entityAt(cursor));
+        }
+        digit = 0;
+        begin(Phase::Count);
+        counts.assign(RADIX, 0);
+        break;
+      }
+
+      case Phase::Count:
+        for (; cursor < codes.size(); cursor++) {
+          if (outOfTime())
+            return false;
+          counts[bucket(codes[cursor])]++;
+        }
+        // Turn counts into each bucket's first output slot
+        for (uint32_t b = 0, next = 0; b < RADIX; b++) {
+          uint32_t count = counts[b];
+          counts[b] = next;
+          next += count;
+        }
+        sortedCodes.resize(codes.size());
+        sortedOrder.resize(order.size());
+        begin(Phase::Scatter);
+        break;
+
+      case Phase::Scatter:
+        for (; cursor < codes.size(); cursor++) {
+          if (outOfTime())
+            return false;
+          uint32_t slot = counts[bucket(codes[cursor])]++;
+          sortedCodes[slot] = codes[cursor];
+          sortedOrder[slot] = order[cursor];
+        }
+        codes.swap(sortedCodes);
+        order.swap(sortedOrder);
+        if (++digit < 2) {
+          begin(Phase::Count);
+          counts.assign(RADIX, 0);
+        } else {
+          begin(Phase::Place);
+        }
+        break;
+
+      case Phase::Place:
+        for (; cursor < order.size(); cursor++) {
+          if (outOfTime())
+            return false;
+          place(world, order[cursor]);
+        }
+        phase = Phase::Idle;
+        break;
+
+      case Phase::Idle:
+        break;
+      }
+    }
+  }
+
+private:
+  enum class Phase { Idle, Bounds, Codes, Count, Scatter, Place };
+
+  static constexpr uint32_t RADIX = 1u << 15;
+
+  static uint32_t quantize(float offset, float extent) {
+    if (!(extent > 0.0f))
+      return 0;
+    float cell = offset / extent * 1023.0f;
+    return static_cast<uint32_t>(std::min(std::max(cell, 0.0f), 1023.0f));
+  }
+
+  uint32_t bucket(uint32_t code) const {
+    return (code >> (digit * 15)) & (RADIX - 1);
+  }
+
+  uint32_t rows() const { return archetype->size(); }
+
+  void begin(Phase next) {
+    phase = next;
+    cursor = 0;
+  }
+
+  // Starts on the next archetype storing T; false once all have been done
+  bool nextArchetype(ECS2 &world) {
+    uint8_t id = ComponentTypeManager::getId<T>();
+    while (archetypeCursor < world.archetypeList.size()) {
+      Archetype *candidate = world.archetypeList[archetypeCursor++];
+      if (candidate->hasColumn(id) && candidate->size() > 1) {
+        archetype = candidate;
+        low = glm::vec3(std::numeric_limits<float>::max());
+        high = glm::vec3(std::numeric_limits<float>::lowest());
+        begin(Phase::Bounds);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Moves e to row `cursor`, the slot the sort gave it, unless it left the
+  // archetype or the archetype shrank past that row since the codes were
+  // taken
+  void place(ECS2 &world, Entity e) {
+    if (!world.isAlive(e) || cursor >= rows())
+      return;
+    auto &target = world.locations[entityIndex(e)];
+    if (target.archetype != archetype)
+      return;
+    uint32_t row = static_cast<uint32_t>(cursor);
+    if (target.row == row)
+      return;
+    Entity displaced = archetype->entityAt(row);
+    archetype->swapRows(target.row, row);
+    world.locations[entityIndex(displaced)].row = target.row;
+    target.row = row;
+  }
+
+  PositionFn position;
+  Phase phase = Phase::Idle;
+  size_t archetypeCursor = 0; // Next index into the world's archetype list
+  Archetype *archetype = nullptr;
+  size_t cursor = 0; // Row or element the current phase resumes at
+  uint32_t digit = 0;
+  glm::vec3 low{0.0f};
+  glm::vec3 high{0.0f};
+
+  std::vector<uint32_t> codes;
+  std::vector<Entity> order; // Entity per code
+  std::vector<uint32_t> sortedCodes;
+  std::vector<Entity> sortedOrder;
+  std::vector<uint32_t> counts; // Per radix bucket
+};
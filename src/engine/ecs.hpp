@@ -20,7 +20,7 @@ public:
   void add(Entity e, Component &c) { data[e] = c; }
   bool has(Entity e) const { return data.contains(e); }
   Component &get(Entity e) { return data.at(e); }
-  void remove(Entity e) const { data.erase(e); }
+  void remove(Entity e) { data.erase(e); }
 
   auto &all() { return data; }
 
@@ -1,104 +1,1878 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <bitset>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
-#include <typeindex>
+#include <mutex>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Entity handles pack a slot index with a generation that is bumped every
+// time the slot is recycled, so handles to destroyed entities go stale
+// instead of silently aliasing whatever reuses the slot. 0 is never valid.
 using Entity = uint32_t;
 const uint32_t MAX_COMPONENTS = 64;
 using Signature = std::bitset<MAX_COMPONENTS>;
 
+constexpr uint32_t ENTITY_INDEX_BITS = 22;
+constexpr uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+constexpr uint32_t ENTITY_GENERATION_MASK =
+    (1u << (32 - ENTITY_INDEX_BITS)) - 1;
+constexpr Entity NULL_ENTITY = 0;
+
+inline uint32_t entityIndex(Entity e) { return e & ENTITY_INDEX_MASK; }
+inline uint32_t entityGeneration(Entity e) { return e >> ENTITY_INDEX_BITS; }
+inline Entity makeEntity(uint32_t index, uint32_t generation) {
+  return (generation << ENTITY_INDEX_BITS) | index;
+}
+
 // -- Config --
 
+// Archetype chunks are fixed-size blocks holding one contiguous column per
+// component type, so iterating an archetype streams through memory linearly.
+constexpr size_t ARCHETYPE_CHUNK_SIZE = 16 * 1024;
+constexpr size_t ARCHETYPE_CHUNK_ALIGN = 64;
+
+// Sparse-set stores page their entity -> index table so rarely used
+// components only pay for the pages their entities fall into.
+constexpr size_t SPARSE_PAGE_SIZE = 4096;
+
+enum class StorageMode { Map, SparseSet, Archetype, Tag };
+
+// Components default to their own hash map store. Specialise this next to a
+// component to pick another backend:
+//   template <> struct ComponentStorage<Transform> : ArchetypeStorage {};
+template <typename T> struct ComponentStorage {
+  static constexpr StorageMode mode = StorageMode::Map;
+};
+
+struct SparseSetStorage {
+  static constexpr StorageMode mode = StorageMode::SparseSet;
+};
+
+struct ArchetypeStorage {
+  static constexpr StorageMode mode = StorageMode::Archetype;
+};
+
+// Empty types are tags: they only ever set a bit in the entity's Signature
+// and have no store, no archetype column and no change ticks.
+template <typename T>
+constexpr bool isTag = std::is_empty_v<std::remove_const_t<T>>;
+
+// Const-qualified component types (view<const Transform>) are read-only
+// accesses to the same component
+template <typename T>
+constexpr StorageMode storageModeOf =
+    isTag<T> ? StorageMode::Tag
+             : ComponentStorage<std::remove_const_t<T>>::mode;
+
+template <typename T>
+constexpr bool isArchetypeStored = storageModeOf<T> == StorageMode::Archetype;
+
+// When a component slot was added and last written, in world ticks. Writes
+// through mutable accessors stamp `changed`; const access never does.
+struct ComponentTicks {
+  uint32_t added = 0;
+  uint32_t changed = 0;
+};
+
+// True when `tick` is later than `since`. Ticks wrap, so this holds as long
+// as the two are less than 2^31 ticks apart.
+inline bool isNewerTick(uint32_t tick, uint32_t since) {
+  return static_cast<int32_t>(tick - since) > 0;
+}
+
+class ECS2;
+
+// The system currently running on this thread. The Scheduler sets this
+// around every system so its writes are stamped with its own run and its
+// views filter against its previous run.
+struct SystemTicks {
+  const ECS2 *world = nullptr;
+  uint32_t thisRun = 0;
+  uint32_t lastRun = 0;
+};
+
+inline thread_local SystemTicks currentSystemTicks;
+
+// Type-erased operations archetypes need to move components between chunks
+struct ComponentInfo {
+  size_t size = 0;
+  size_t align = 0;
+  void (*moveConstruct)(void *dst, void *src) = nullptr;
+  void (*copyConstruct)(void *dst, const void *src) = nullptr; // If copyable
+  void (*destroy)(void *ptr) = nullptr;
+};
+
 class ComponentTypeManager {
 public:
   template <typename T> static uint8_t getId() {
-    static uint8_t typeId = nextId++;
-    return typeId;
+    if constexpr (std::is_const_v<T>) {
+      return getId<std::remove_const_t<T>>();
+    } else {
+      static uint8_t typeId = registerType<T>();
+      return typeId;
+    }
   }
 
+  static const ComponentInfo &getInfo(uint8_t id) { return infos[id]; }
+
 private:
+  template <typename T> static uint8_t registerType() {
+    if (nextId >= MAX_COMPONENTS) {
+      throw std::runtime_error("Exceeded MAX_COMPONENTS!");
+    }
+    uint8_t id = nextId++;
+    ComponentInfo info;
+    info.size = sizeof(T);
+    info.align = alignof(T);
+    info.moveConstruct = [](void *dst, void *src) {
+      new (dst) T(std::move(*static_cast<T *>(src)));
+    };
+    if constexpr (std::is_copy_constructible_v<T>) {
+      info.copyConstruct = [](void *dst, const void *src) {
+        new (dst) T(*static_cast<const T *>(src));
+      };
+    }
+    info.destroy = [](void *ptr) { static_cast<T *>(ptr)->~T(); };
+    infos[id] = info;
+    return id;
+  }
+
   inline static uint8_t nextId = 0;
+  inline static ComponentInfo infos[MAX_COMPONENTS] = {};
 };
 
 class IComponentStore {
 public:
   virtual ~IComponentStore() = default;
   virtual void removeEntity(Entity e) = 0;
+  // Type-erased add used by prefab spawning; component points to a T
+  virtual void addCopy(Entity e, const void *component, uint32_t tick) = 0;
+  virtual void reserve(size_t additional) = 0;
+  // An empty store of the same type, e.g. for another world
+  virtual std::unique_ptr<IComponentStore> createEmpty() const = 0;
+  // Moves e's component into dst, a store of the same type, as target's
+  virtual void moveTo(Entity e, IComponentStore &dst, Entity target,
+                      uint32_t tick) = 0;
 };
 
-template <typename T> class ComponentStore : public IComponentStore {
+template <typename T, StorageMode Mode = storageModeOf<T>>
+class ComponentStore;
+
+template <typename T>
+class ComponentStore<T, StorageMode::Map> : public IComponentStore {
 public:
-  void add(Entity e, T component) { data[e] = component; }
+  void add(Entity e, T component, uint32_t tick) {
+    auto [it, inserted] = data.try_emplace(e);
+    it->second.value = std::move(component);
+    if (inserted) {
+      it->second.ticks.added = tick;
+    }
+    it->second.ticks.changed = tick;
+  }
   void removeEntity(Entity e) override { data.erase(e); }
-  T &get(Entity e) { return data.at(e); }
+  void addCopy(Entity e, const void *component, uint32_t tick) override {
+    if constexpr (std::is_copy_constructible_v<T>) {
+      add(e, *static_cast<const T *>(component), tick);
+    } else {
+      throw std::logic_error("Component is not copyable!");
+    }
+  }
+  void reserve(size_t additional) override {
+    data.reserve(data.size() + additional);
+  }
+  std::unique_ptr<IComponentStore> createEmpty() const override {
+    return std::make_unique<ComponentStore>();
+  }
+  void moveTo(Entity e, IComponentStore &dst, Entity target,
+              uint32_t tick) override {
+    auto it = data.find(e);
+    if (it == data.end())
+      return;
+    auto &store = static_cast<ComponentStore &>(dst);
+    store.add(target, std::move(it->second.value), tick);
+    data.erase(it);
+  }
+  T &get(Entity e) { return data.at(e).value; }
+  ComponentTicks &ticks(Entity e) { return data.at(e).ticks; }
   bool has(Entity e) const { return data.contains(e); }
 
 private:
-  std::unordered_map<Entity, T> data;
+  struct Entry {
+    T value;
+    ComponentTicks ticks;
+  };
+
+  std::unordered_map<Entity, Entry> data;
 };
 
+// Components packed in a dense array with a parallel entity list. Lookups go
+// through a paged sparse table and removal swaps the last element into the
+// hole, so every operation is O(1) and iteration never touches a gap.
+template <typename T>
+class ComponentStore<T, StorageMode::SparseSet> : public IComponentStore {
+public:
+  void add(Entity e, T component, uint32_t tick) {
+    uint32_t &index = sparseSlot(e);
+    if (index != INVALID_INDEX) {
+      dense[index] = std::move(component);
+      denseTicks[index].changed = tick;
+      return;
+    }
+    index = static_cast<uint32_t>(dense.size());
+    dense.push_back(std::move(component));
+    denseTicks.push_back({tick, tick});
+    entities.push_back(e);
+  }
+
+  void removeEntity(Entity e) override {
+    if (!has(e))
+      return;
+    uint32_t &index = sparseSlot(e);
+    uint32_t last = static_cast<uint32_t>(dense.size() - 1);
+    if (index != last) {
+      dense[index] = std::move(dense[last]);
+      denseTicks[index] = denseTicks[last];
+      entities[index] = entities[last];
+      sparseSlot(entities[index]) = index;
+    }
+    dense.pop_back();
+    denseTicks.pop_back();
+    entities.pop_back();
+    index = INVALID_INDEX;
+  }
+
+  void addCopy(Entity e, const void *component, uint32_t tick) override {
+    if constexpr (std::is_copy_constructible_v<T>) {
+      add(e, *static_cast<const T *>(component), tick);
+    } else {
+      throw std::logic_error("Component is not copyable!");
+    }
+  }
+
+  void reserve(size_t additional) override {
+    dense.reserve(dense.size() + additional);
+    denseTicks.reserve(denseTicks.size() + additional);
+    entities.reserve(entities.size() + additional);
+  }
+
+  std::unique_ptr<IComponentStore> createEmpty() const override {
+    return std::make_unique<ComponentStore>();
+  }
+
+  void moveTo(Entity e, IComponentStore &dst, Entity target,
+              uint32_t tick) override {
+    if (!has(e))
+      return;
+    auto &store = static_cast<ComponentStore &>(dst);
+    store.add(target, std::move(dense[denseIndex(e)]), tick);
+    removeEntity(e);
+  }
+
+  T &get(Entity e) {
+    if (!has(e)) {
+      throw std::out_of_range("Entity does not have component!");
+    }
+    return dense[denseIndex(e)];
+  }
+
+  ComponentTicks &ticks(Entity e) { return denseTicks[denseIndex(e)]; }
+
+  // Also compares the stored handle so a stale entity never matches
+  bool has(Entity e) const {
+    uint32_t index = entityIndex(e);
+    size_t page = index / SPARSE_PAGE_SIZE;
+    if (page >= pages.size() || !pages[page])
+      return false;
+    uint32_t slot = pages[page][index % SPARSE_PAGE_SIZE];
+    return slot != INVALID_INDEX && entities[slot] == e;
+  }
+
+  size_t size() const { return dense.size(); }
+  T *data() { return dense.data(); }
+  ComponentTicks *tickData() { return denseTicks.data(); }
+  const Entity *getEntities() const { return entities.data(); }
+
+private:
+  static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+  uint32_t denseIndex(Entity e) const {
+    uint32_t index = entityIndex(e);
+    return pages[index / SPARSE_PAGE_SIZE][index % SPARSE_PAGE_SIZE];
+  }
+
+  uint32_t &sparseSlot(Entity e) {
+    uint32_t index = entityIndex(e);
+    size_t page = index / SPARSE_PAGE_SIZE;
+    if (page >= pages.size()) {
+      pages.resize(page + 1);
+    }
+    if (!pages[page]) {
+      pages[page] = std::make_unique<uint32_t[]>(SPARSE_PAGE_SIZE);
+      std::fill_n(pages[page].get(), SPARSE_PAGE_SIZE, INVALID_INDEX);
+    }
+    return pages[page][index % SPARSE_PAGE_SIZE];
+  }
+
+  std::vector<std::unique_ptr<uint32_t[]>> pages;
+  std::vector<T> dense;
+  std::vector<ComponentTicks> denseTicks;
+  std::vector<Entity> entities;
+};
+
+// -- Archetypes --
+
+// All entities sharing the same set of archetype-stored components. Rows are
+// packed densely across chunks; row r lives in chunk r / chunkCapacity.
+class Archetype {
+public:
+  struct Column {
+    uint8_t componentId;
+    size_t offset;     // Byte offset of this column inside every chunk
+    size_t tickOffset; // Byte offset of its ComponentTicks column
+    const ComponentInfo *info;
+  };
+
+  explicit Archetype(Signature signature) : signature(signature) {
+    std::fill_n(columnIndex, MAX_COMPONENTS, -1);
+    for (uint32_t id = 0; id < MAX_COMPONENTS; id++) {
+      if (!signature.test(id))
+        continue;
+      const ComponentInfo &info = ComponentTypeManager::getInfo(id);
+      if (info.align > ARCHETYPE_CHUNK_ALIGN) {
+        throw std::runtime_error("Component alignment exceeds chunk size!");
+      }
+      columnIndex[id] = static_cast<int8_t>(columns.size());
+      columns.push_back({static_cast<uint8_t>(id), 0, 0, &info});
+    }
+    layoutChunk();
+  }
+
+  Archetype(const Archetype &) = delete;
+  Archetype &operator=(const Archetype &) = delete;
+
+  ~Archetype() {
+    for (uint32_t row = 0; row < rowCount; row++) {
+      for (size_t c = 0; c < columns.size(); c++) {
+        columns[c].info->destroy(slot(c, row));
+      }
+    }
+  }
+
+  const Signature &getSignature() const { return signature; }
+  uint32_t size() const { return rowCount; }
+  uint32_t capacity() const { return chunkCapacity; }
+  size_t chunkCount() const { return chunks.size(); }
+
+  uint32_t chunkSize(size_t chunk) const {
+    uint32_t first = static_cast<uint32_t>(chunk) * chunkCapacity;
+    return std::min(chunkCapacity, rowCount - first);
+  }
+
+  bool hasColumn(uint8_t componentId) const {
+    return columnIndex[componentId] >= 0;
+  }
+
+  Entity *entities(size_t chunk) {
+    return reinterpret_cast<Entity *>(chunks[chunk].get());
+  }
+
+  Entity entityAt(uint32_t row) {
+    return entities(row / chunkCapacity)[row % chunkCapacity];
+  }
+
+  // Start of the column for T in a chunk, or nullptr if T is not stored here
+  template <typename T> T *column(size_t chunk) {
+    int8_t c = columnIndex[ComponentTypeManager::getId<T>()];
+    if (c < 0)
+      return nullptr;
+    return reinterpret_cast<T *>(chunks[chunk].get() + columns[c].offset);
+  }
+
+  template <typename T> T &get(uint32_t row) {
+    return column<T>(row / chunkCapacity)[row % chunkCapacity];
+  }
+
+  // Change ticks for T in a chunk, or nullptr if T is not stored here
+  template <typename T> ComponentTicks *ticks(size_t chunk) {
+    int8_t c = columnIndex[ComponentTypeManager::getId<T>()];
+    if (c < 0)
+      return nullptr;
+    return reinterpret_cast<ComponentTicks *>(chunks[chunk].get() +
+                                              columns[c].tickOffset);
+  }
+
+  ComponentTicks &ticksAt(size_t column, uint32_t row) {
+    return reinterpret_cast<ComponentTicks *>(
+        chunks[row / chunkCapacity].get() +
+        columns[column].tickOffset)[row % chunkCapacity];
+  }
+
+  ComponentTicks &ticksFor(uint8_t componentId, uint32_t row) {
+    return ticksAt(columnIndex[componentId], row);
+  }
+
+  void *slot(size_t column, uint32_t row) {
+    const Column &col = columns[column];
+    return chunks[row / chunkCapacity].get() + col.offset +
+           (row % chunkCapacity) * col.info->size;
+  }
+
+  void *slotFor(uint8_t componentId, uint32_t row) {
+    return slot(columnIndex[componentId], row);
+  }
+
+  const std::vector<Column> &getColumns() const { return columns; }
+
+  // Allocates chunks up front so the next `rows` rows fit
+  void reserve(uint32_t rows) {
+    size_t needed = (size_t(rowCount) + rows + chunkCapacity - 1) /
+                    chunkCapacity;
+    while (chunks.size() < needed) {
+      chunks.emplace_back(static_cast<std::byte *>(::operator new[](
+          chunkBytes, std::align_val_t{ARCHETYPE_CHUNK_ALIGN})));
+    }
+  }
+
+  // Reserves a row for e; the caller must construct every column in it
+  uint32_t allocateRow(Entity e) {
+    uint32_t row = rowCount++;
+    if (row / chunkCapacity >= chunks.size()) {
+      chunks.emplace_back(static_cast<std::byte *>(::operator new[](
+          chunkBytes, std::align_val_t{ARCHETYPE_CHUNK_ALIGN})));
+    }
+    entities(row / chunkCapacity)[row % chunkCapacity] = e;
+    return row;
+  }
+
+  // Destroys the row and fills the hole with the last row. Returns the entity
+  // that was moved into `row`, or 0 if nothing moved.
+  Entity removeRow(uint32_t row) {
+    uint32_t last = rowCount - 1;
+    Entity moved = 0;
+    for (size_t c = 0; c < columns.size(); c++) {
+      columns[c].info->destroy(slot(c, row));
+      if (row != last) {
+        columns[c].info->moveConstruct(slot(c, row), slot(c, last));
+        columns[c].info->destroy(slot(c, last));
+        ticksAt(c, row) = ticksAt(c, last);
+      }
+    }
+    if (row != last) {
+      moved = entities(last / chunkCapacity)[last % chunkCapacity];
+      entities(row / chunkCapacity)[row % chunkCapacity] = moved;
+    }
+    rowCount--;
+    // Release trailing chunks once they are empty
+    while (!chunks.empty() &&
+           (chunks.size() - 1) * chunkCapacity >= rowCount) {
+      chunks.pop_back();
+    }
+    return moved;
+  }
+
+  // Takes over every row of other, an archetype with the same signature in
+  // another world, by moving its chunks. This archetype must be empty. The
+  // caller rewrites the entity column and locations.
+  void adoptRows(Archetype &other) {
+    if (rowCount != 0 || other.signature != signature ||
+        other.chunkBytes != chunkBytes) {
+      throw std::logic_error("Archetype cannot adopt these rows!");
+    }
+    chunks = std::move(other.chunks);
+    other.chunks.clear();
+    rowCount = other.rowCount;
+    other.rowCount = 0;
+  }
+
+  // Exchanges two rows, change ticks included. The caller fixes up the
+  // entity locations.
+  void swapRows(uint32_t a, uint32_t b) {
+    if (a == b)
+      return;
+    if (!scratch) {
+      size_t largest = 0;
+      for (const Column &col : columns)
+        largest = std::max(largest, col.info->size);
+      scratch.reset(static_cast<std::byte *>(::operator new[](
+          std::max<size_t>(largest, 1),
+          std::align_val_t{ARCHETYPE_CHUNK_ALIGN})));
+    }
+    for (size_t c = 0; c < columns.size(); c++) {
+      const ComponentInfo &info = *columns[c].info;
+      info.moveConstruct(scratch.get(), slot(c, a));
+      info.destroy(slot(c, a));
+      info.moveConstruct(slot(c, a), slot(c, b));
+      info.destroy(slot(c, b));
+      info.moveConstruct(slot(c, b), scratch.get());
+      info.destroy(scratch.get());
+      std::swap(ticksAt(c, a), ticksAt(c, b));
+    }
+    Entity first = entityAt(a);
+    entities(a / chunkCapacity)[a % chunkCapacity] = entityAt(b);
+    entities(b / chunkCapacity)[b % chunkCapacity] = first;
+  }
+
+private:
+  struct ChunkDeleter {
+    void operator()(std::byte *p) const {
+      ::operator delete[](p, std::align_val_t{ARCHETYPE_CHUNK_ALIGN});
+    }
+  };
+
+  // Fit as many rows as possible into one chunk, keeping every column aligned
+  void layoutChunk() {
+    size_t rowBytes = sizeof(Entity);
+    for (auto &col : columns)
+      rowBytes += col.info->size + sizeof(ComponentTicks);
+
+    chunkCapacity =
+        std::max<uint32_t>(1, static_cast<uint32_t>(ARCHETYPE_CHUNK_SIZE /
+                                                    rowBytes));
+    while (true) {
+      size_t offset = sizeof(Entity) * chunkCapacity;
+      for (auto &col : columns) {
+        offset = (offset + col.info->align - 1) & ~(col.info->align - 1);
+        col.offset = offset;
+        offset += col.info->size * chunkCapacity;
+      }
+      offset = (offset + alignof(ComponentTicks) - 1) &
+               ~(alignof(ComponentTicks) - 1);
+      for (auto &col : columns) {
+        col.tickOffset = offset;
+        offset += sizeof(ComponentTicks) * chunkCapacity;
+      }
+      chunkBytes = offset;
+      if (chunkBytes <= ARCHETYPE_CHUNK_SIZE || chunkCapacity == 1)
+        break;
+      chunkCapacity--;
+    }
+  }
+
+  Signature signature;
+  int8_t columnIndex[MAX_COMPONENTS];
+  std::vector<Column> columns;
+  std::vector<std::unique_ptr<std::byte[], ChunkDeleter>> chunks;
+  // One value of the largest column, for swapRows
+  std::unique_ptr<std::byte[], ChunkDeleter> scratch;
+  uint32_t chunkCapacity = 1;
+  size_t chunkBytes = 0;
+  uint32_t rowCount = 0;
+};
+
+// One chunk of an archetype, handed to View::eachChunk callbacks
+class ArchetypeChunkView {
+public:
+  ArchetypeChunkView(Archetype *archetype, size_t chunk, uint32_t tick)
+      : archetype(archetype), chunk(chunk), tick(tick) {}
+
+  uint32_t size() const { return archetype->chunkSize(chunk); }
+  const Entity *entities() const { return archetype->entities(chunk); }
+
+  // nullptr when this archetype does not store T. Asking for a mutable
+  // column marks every row in the chunk as changed; ask for column<const T>
+  // to only read.
+  template <typename T> T *column() const {
+    static_assert(isArchetypeStored<T>,
+                  "Only archetype-stored components have chunk columns");
+    T *data = archetype->column<T>(chunk);
+    if constexpr (!std::is_const_v<T>) {
+      if (data) {
+        ComponentTicks *ticks = archetype->ticks<T>(chunk);
+        for (uint32_t i = 0; i < size(); i++) {
+          ticks[i].changed = tick;
+        }
+      }
+    }
+    return data;
+  }
+
+  template <typename T> const ComponentTicks *ticks() const {
+    static_assert(isArchetypeStored<T>,
+                  "Only archetype-stored components have chunk columns");
+    return archetype->ticks<T>(chunk);
+  }
+
+private:
+  Archetype *archetype;
+  size_t chunk;
+  uint32_t tick; // Stamped into mutable columns
+};
+
+// -- Queries --
+
+// Query and view terms. A bare component type is required and handed to
+// view callbacks by reference. With<T> requires T without passing it,
+// Without<T> skips entities that have T and Optional<T> passes a T pointer
+// that is nullptr when the entity lacks T. Changed<T>/Added<T> require T and
+// keep only entities whose T was written (Changed) or added (Added) after
+// the view's `since` tick; they are not passed either.
+template <typename T> struct With {};
+template <typename T> struct Without {};
+template <typename T> struct Optional {};
+template <typename T> struct Changed {};
+template <typename T> struct Added {};
+
+struct ViewTermDefaults {
+  static constexpr bool required = true;
+  static constexpr bool excluded = false;
+  static constexpr bool optional = false;
+  static constexpr bool passed = false; // Handed to the view callback
+  static constexpr bool filter = false; // Tested against change ticks
+  static constexpr bool writes = false; // Stamps the changed tick
+  static bool passes(const ComponentTicks &, uint32_t) { return true; }
+};
+
+template <typename Term> struct ViewTerm : ViewTermDefaults {
+  using Component = std::remove_const_t<Term>;
+  static constexpr bool passed = true;
+  static constexpr bool writes = !std::is_const_v<Term> && !isTag<Term>;
+};
+
+template <typename T> struct ViewTerm<With<T>> : ViewTermDefaults {
+  using Component = std::remove_const_t<T>;
+};
+
+template <typename T> struct ViewTerm<Without<T>> : ViewTermDefaults {
+  using Component = std::remove_const_t<T>;
+  static constexpr bool required = false;
+  static constexpr bool excluded = true;
+};
+
+template <typename T> struct ViewTerm<Optional<T>> : ViewTermDefaults {
+  static_assert(!isTag<T>, "Use With<T> or Without<T> for tags");
+  using Component = std::remove_const_t<T>;
+  using Pointer = T *;
+  static constexpr bool required = false;
+  static constexpr bool optional = true;
+  static constexpr bool passed = true;
+  static constexpr bool writes = !std::is_const_v<T>;
+};
+
+template <typename T> struct ViewTerm<Changed<T>> : ViewTermDefaults {
+  static_assert(!isTag<T>, "Tags have no change ticks");
+  using Component = std::remove_const_t<T>;
+  static constexpr bool filter = true;
+  static bool passes(const ComponentTicks &ticks, uint32_t since) {
+    return isNewerTick(ticks.changed, since);
+  }
+};
+
+template <typename T> struct ViewTerm<Added<T>> : ViewTermDefaults {
+  static_assert(!isTag<T>, "Tags have no change ticks");
+  using Component = std::remove_const_t<T>;
+  static constexpr bool filter = true;
+  static bool passes(const ComponentTicks &ticks, uint32_t since) {
+    return isNewerTick(ticks.added, since);
+  }
+};
+
+// Calls f(i) for every i < count whose signature has all of `required` and
+// none of `excluded`, in order. f returning false stops the walk and makes
+// this return false. Signatures are compared four at a time with AVX2 and
+// two at a time with SSE2, so callers should keep them in a dense array.
+template <typename F>
+bool forEachSignatureMatch(const Signature *signatures, size_t count,
+                           const Signature &required,
+                           const Signature &excluded, F &&f) {
+  static_assert(sizeof(Signature) == sizeof(uint64_t),
+                "Signature is matched as a single 64-bit word");
+  // A signature matches when masking it leaves exactly the required bits
+  const uint64_t want = required.to_ullong();
+  const uint64_t mask = want | excluded.to_ullong();
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i wantLanes = _mm256_set1_epi64x(static_cast<long long>(want));
+  const __m256i maskLanes = _mm256_set1_epi64x(static_cast<long long>(mask));
+  for (; i + 4 <= count; i += 4) {
+    __m256i lanes = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(signatures + i));
+    __m256i equal =
+        _mm256_cmpeq_epi64(_mm256_and_si256(lanes, maskLanes), wantLanes);
+    unsigned bits = static_cast<unsigned>(
+        _mm256_movemask_pd(_mm256_castsi256_pd(equal)));
+    for (; bits; bits &= bits - 1) {
+      if (!f(i + std::countr_zero(bits)))
+        return false;
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i wantLanes = _mm_set1_epi64x(static_cast<long long>(want));
+  const __m128i maskLanes = _mm_set1_epi64x(static_cast<long long>(mask));
+  for (; i + 2 <= count; i += 2) {
+    __m128i lanes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(signatures + i));
+    // No 64-bit compare in SSE2; both 32-bit halves have to be equal
+    __m128i equal =
+        _mm_cmpeq_epi32(_mm_and_si128(lanes, maskLanes), wantLanes);
+    int halves = _mm_movemask_ps(_mm_castsi128_ps(equal));
+    if ((halves & 0x3) == 0x3 && !f(i))
+      return false;
+    if ((halves & 0xC) == 0xC && !f(i + 1))
+      return false;
+  }
+#endif
+  for (; i < count; i++) {
+    if ((signatures[i].to_ullong() & mask) == want && !f(i))
+      return false;
+  }
+  return true;
+}
+
+// Entities whose signature contains `required` and nothing of `excluded`.
+// ECS2 keeps one per distinct pair and updates it whenever an entity's
+// signature changes, so reading it costs nothing beyond the matches
+// themselves.
+class Query {
+public:
+  Query(Signature required, Signature excluded)
+      : required(required), excluded(excluded) {}
+
+  bool matches(const Signature &signature) const {
+    return (signature & (required | excluded)) == required;
+  }
+
+  const Signature &getRequired() const { return required; }
+  const Signature &getExcluded() const { return excluded; }
+  const std::vector<Entity> &getEntities() const { return entities; }
+
+  void insert(Entity e) {
+    uint32_t slot = entityIndex(e);
+    if (positions.size() <= slot) {
+      positions.resize(slot + 1);
+    }
+    positions[slot] = static_cast<uint32_t>(entities.size());
+    entities.push_back(e);
+  }
+
+  // Does nothing unless e itself is a member; a stale handle must not take
+  // out the entity that reuses its index
+  void erase(Entity e) {
+    uint32_t slot = entityIndex(e);
+    if (slot >= positions.size())
+      return;
+    uint32_t index = positions[slot];
+    if (index >= entities.size() || entities[index] != e)
+      return;
+    Entity last = entities.back();
+    entities[index] = last;
+    positions[entityIndex(last)] = index;
+    entities.pop_back();
+  }
+
+private:
+  Signature required;
+  Signature excluded;
+  std::vector<Entity> entities;
+  std::vector<uint32_t> positions; // Entity index -> index into entities
+};
+
+struct QueryKey {
+  Signature required;
+  Signature excluded;
+
+  bool operator==(const QueryKey &) const = default;
+};
+
+struct QueryKeyHash {
+  size_t operator()(const QueryKey &key) const {
+    std::hash<Signature> hash;
+    return hash(key.required) ^ (hash(key.excluded) * 31);
+  }
+};
+
+// Hands out a dense id per query type list so ECS2 can find a cached Query
+// with an array index instead of hashing the requirement every call
+class QueryTypeManager {
+public:
+  template <typename... Terms> static size_t getId() {
+    static size_t typeId = nextId.fetch_add(1, std::memory_order_relaxed);
+    return typeId;
+  }
+
+private:
+  inline static std::atomic<size_t> nextId = 0;
+};
+
+template <typename... Components> class View;
+class Prefab;
+
+using ObserverId = uint32_t;
+
+enum class ObserverEvent { Add, Remove, Replace };
+
 class ECS2 {
 public:
   Entity createEntity() {
-    Entity id = nextEntity++;
-    signatures[id] = Signature(0);
+    Entity id = allocateHandle();
+    for (Query *query : queryList) {
+      if (query->matches(Signature(0))) {
+        query->insert(id);
+      }
+    }
     return id;
   }
 
+  // Removes every component of e and recycles its slot. Handles to e are
+  // stale afterwards; destroying a stale handle does nothing.
+  void destroyEntity(Entity e) {
+    if (!isAlive(e))
+      return;
+    uint32_t index = entityIndex(e);
+
+    // Inside a batch the queries still reflect the pre-batch signature
+    Signature membership = signatures[index];
+    if (batching && index < batchSlots.size() && batchSlots[index]) {
+      uint32_t pos = batchSlots[index] - 1;
+      membership = batchPrevious[pos];
+      batchEntities[pos] = NULL_ENTITY;
+      batchSlots[index] = 0;
+    }
+    for (Query *query : queryList) {
+      if (query->matches(membership)) {
+        query->erase(e);
+      }
+    }
+    recordObserved(e, signatures[index], true);
+    if (locations[index].archetype) {
+      moveEntity(e, nullptr);
+    }
+    for (uint32_t id = 0; id < MAX_COMPONENTS; id++) {
+      if (signatures[index].test(id) && stores[id]) {
+        stores[id]->removeEntity(e);
+      }
+    }
+
+    signatures[index].reset();
+    handles[index] = NULL_ENTITY;
+    freeList.push_back(
+        makeEntity(index, (entityGeneration(e) + 1) & ENTITY_GENERATION_MASK));
+  }
+
+  bool isAlive(Entity e) const {
+    uint32_t index = entityIndex(e);
+    return e != NULL_ENTITY && index < handles.size() && handles[index] == e;
+  }
+
+  size_t getEntityCount() const { return handles.size() - 1 - freeList.size(); }
+
+  // Adding to a stale handle does nothing, like removing from one
   template <typename T> void addComponent(Entity e, T component) {
-    auto store = getStore<T>();
+    if (!isAlive(e))
+      return;
+    uint8_t componentId = ComponentTypeManager::getId<T>();
+    Signature &signature = signatures[entityIndex(e)];
+    Signature previous = signature;
+    uint32_t tick = writeTick();
 
-    if (!store) {
-      throw std::runtime_error("Failed to retrieve store for component!");
+    if constexpr (isTag<T>) {
+      (void)component;
+      (void)tick;
+    } else if constexpr (isArchetypeStored<T>) {
+      EntityLocation &loc = locations[entityIndex(e)];
+      if (loc.archetype && loc.archetype->hasColumn(componentId)) {
+        loc.archetype->template get<T>(loc.row) = std::move(component);
+        loc.archetype->ticksFor(componentId, loc.row).changed = tick;
+      } else {
+        Signature target =
+            loc.archetype ? loc.archetype->getSignature() : Signature(0);
+        target.set(componentId);
+        Archetype *dst = getArchetype(target);
+        uint32_t row = moveEntity(e, dst);
+        new (dst->slotFor(componentId, row)) T(std::move(component));
+        dst->ticksFor(componentId, row) = {tick, tick};
+      }
+    } else {
+      getStore<T>().add(e, std::move(component), tick);
     }
 
-    store->add(e, component);
+    if (observed.test(componentId)) {
+      recordObserved(e, componentId, previous.test(componentId));
+    }
+    signature.set(componentId, true);
+    if (signature != previous) {
+      updateQueries(e, previous);
+    }
+  }
 
+  template <typename T> void removeComponent(Entity e) {
     uint8_t componentId = ComponentTypeManager::getId<T>();
-    if (componentId >= MAX_COMPONENTS) {
-      throw std::runtime_error("Exceeded MAX_COMPONENTS!");
+    if (!hasComponent<T>(e))
+      return;
+    Signature &signature = signatures[entityIndex(e)];
+    Signature previous = signature;
+    if (observed.test(componentId)) {
+      recordObserved(e, componentId, true);
+    }
+
+    if constexpr (isArchetypeStored<T>) {
+      Signature target = locations[entityIndex(e)].archetype->getSignature();
+      target.reset(componentId);
+      moveEntity(e, target.none() ? nullptr : getArchetype(target));
+    } else if constexpr (!isTag<T>) {
+      getStore<T>().removeEntity(e);
     }
 
-    signatures[e].set(componentId, true);
+    signature.reset(componentId);
+    updateQueries(e, previous);
   }
 
+  // Marks the component changed; use getComponent<const T> to only read.
+  // Throws std::out_of_range for a stale handle.
   template <typename T> T &getComponent(Entity e) {
-    return getStore<T>()->get(e);
+    static_assert(!isTag<T>, "Tags carry no data; use hasComponent");
+    using Component = std::remove_const_t<T>;
+    requireAlive(e);
+    if constexpr (isArchetypeStored<T>) {
+      EntityLocation &loc = locations[entityIndex(e)];
+      uint8_t componentId = ComponentTypeManager::getId<T>();
+      if (!loc.archetype || !loc.archetype->hasColumn(componentId)) {
+        throw std::out_of_range("Entity does not have component!");
+      }
+      if constexpr (!std::is_const_v<T>) {
+        loc.archetype->ticksFor(componentId, loc.row).changed = writeTick();
+      }
+      return loc.archetype->template get<Component>(loc.row);
+    } else {
+      auto &store = getStore<Component>();
+      Component &component = store.get(e);
+      if constexpr (!std::is_const_v<T>) {
+        store.ticks(e).changed = writeTick();
+      }
+      return component;
+    }
+  }
+
+  // Like getComponent, but nullptr when e does not have T
+  template <typename T> T *tryGetComponent(Entity e) {
+    if (!hasComponent<T>(e))
+      return nullptr;
+    return &getComponent<T>(e);
+  }
+
+  // When T was added to e and last written
+  template <typename T> ComponentTicks getTicks(Entity e) {
+    static_assert(!isTag<T>, "Tags have no change ticks");
+    using Component = std::remove_const_t<T>;
+    requireAlive(e);
+    if constexpr (isArchetypeStored<T>) {
+      EntityLocation &loc = locations[entityIndex(e)];
+      uint8_t componentId = ComponentTypeManager::getId<T>();
+      if (!loc.archetype || !loc.archetype->hasColumn(componentId)) {
+        throw std::out_of_range("Entity does not have component!");
+      }
+      return loc.archetype->ticksFor(componentId, loc.row);
+    } else {
+      return getStore<Component>().ticks(e);
+    }
   }
 
   template <typename T> bool hasComponent(Entity e) {
-    return signatures[e].test(ComponentTypeManager::getId<T>());
+    return isAlive(e) &&
+           signatures[entityIndex(e)].test(ComponentTypeManager::getId<T>());
+  }
+
+  // Direct access to a non-archetype store, e.g. to walk a sparse set's
+  // dense component array without going through query()
+  template <typename T> ComponentStore<T> &getStorage() {
+    static_assert(!isArchetypeStored<T>,
+                  "Archetype-stored components are reached via view()");
+    static_assert(!isTag<T>, "Tags have no store");
+    return getStore<T>();
+  }
+
+  // Entities matching Terms: bare components and With<T> are required,
+  // Without<T> excluded, Optional<T> ignored. The returned list is owned by
+  // the world and stays current as components are added and removed.
+  //
+  // The first call for a Terms list registers its query under a lock, so
+  // query() and view() may be called from systems running in parallel,
+  // including for lists no other system has used yet. The world must not
+  // change structurally meanwhile, and the component stores behind a view
+  // are still created on first use without a lock; see Scheduler.
+  template <typename... Terms> const std::vector<Entity> &query() {
+    size_t id = QueryTypeManager::getId<Terms...>();
+    Query *query = cachedQuery(id);
+    if (!query) {
+      QueryKey key;
+      (addQueryTerm<Terms>(key), ...);
+      query = cacheQuery(id, key);
+    }
+    return query->getEntities();
   }
 
-  template <typename... Components> std::vector<Entity> query() {
-    Signature requirement;
-    // Fold expression to set bits for all requested types
-    ((requirement.set(ComponentTypeManager::getId<Components>())), ...);
+  // Between beginBatch() and endBatch() cached queries are not touched per
+  // change; endBatch() updates them once per entity whose signature differs
+  // from what it was when the batch started. Used to apply command buffers.
+  void beginBatch() { batching = true; }
 
-    std::vector<Entity> results;
-    for (auto const &[entity, sig] : signatures) {
-      if ((sig & requirement) == requirement) {
-        results.push_back(entity);
+  void endBatch() {
+    batching = false;
+    for (size_t i = 0; i < batchEntities.size(); i++) {
+      Entity e = batchEntities[i];
+      if (e == NULL_ENTITY)
+        continue;
+      batchSlots[entityIndex(e)] = 0;
+      if (signatures[entityIndex(e)] != batchPrevious[i]) {
+        updateQueries(e, batchPrevious[i]);
+      }
+    }
+    batchEntities.clear();
+    batchPrevious.clear();
+  }
+
+  // Typed, allocation-free iteration over entities that have all of
+  // Components. See View below. Changed<T>/Added<T> terms compare against
+  // `since`, which defaults to the previous run of the calling system.
+  template <typename... Terms> View<Terms...> view();
+  template <typename... Terms> View<Terms...> view(uint32_t since);
+
+  // Creates count entities carrying the prefab's components, allocating
+  // archetype chunks and store capacity once for the whole batch. The
+  // second form also gives instance i its own T, e.g. a Transform per copy.
+  // Defined in engine/prefab.hpp.
+  std::vector<Entity> spawnBatch(const Prefab &prefab, size_t count);
+  template <typename T>
+  std::vector<Entity> spawnBatch(const Prefab &prefab,
+                                 std::span<const T> instances);
+
+  // Moves entities and all their components from one world to another and
+  // returns their handles in `to`, in the same order (NULL_ENTITY for dead
+  // or repeated ones). Entities are handled per signature: an archetype
+  // that moves over whole into an empty counterpart hands over its chunks,
+  // anything else is moved column by column. Moved components count as
+  // added in `to`. Components holding Entity handles (Parent, Children)
+  // still name `from` entities and must be remapped by the caller.
+  static std::vector<Entity> migrate(std::span<const Entity> entities,
+                                     ECS2 &from, ECS2 &to);
+
+  // Change ticks. Every scheduled system run advances the tick; code running
+  // outside a system (loading, input callbacks, the renderer) can call
+  // advanceTick() itself to get a point to compare against next time.
+  uint32_t getTick() const { return changeTick.load(); }
+  uint32_t advanceTick() { return changeTick.fetch_add(1) + 1; }
+
+  // Tick that writes made right now are stamped with. Outside a system it is
+  // one past the current tick so the write is newer than any run so far.
+  uint32_t writeTick() const {
+    if (currentSystemTicks.world == this)
+      return currentSystemTicks.thisRun;
+    return changeTick.load() + 1;
+  }
+
+  // The `since` tick views use by default
+  uint32_t lastRunTick() const {
+    return currentSystemTicks.world == this ? currentSystemTicks.lastRun : 0;
+  }
+
+  // Observers. Adds, removes and replacements (addComponent on an entity
+  // that already has T) of an observed component are recorded as they
+  // happen and delivered in batches by flushObservers(), which the
+  // Scheduler calls before and after every run. Events are netted per
+  // entity over the batch: added then removed is dropped, removed then added
+  // again is a replace. Remove lists name entities whose component (or the
+  // entity itself) is already gone. Changes made by a callback are delivered
+  // on the next flush.
+  using ObserverCallback =
+      std::function<void(ECS2 &, std::span<const Entity>)>;
+
+  template <typename T> ObserverId onAdd(ObserverCallback callback) {
+    return addObserver(ComponentTypeManager::getId<T>(), ObserverEvent::Add,
+                       std::move(callback));
+  }
+  template <typename T> ObserverId onRemove(ObserverCallback callback) {
+    return addObserver(ComponentTypeManager::getId<T>(),
+                       ObserverEvent::Remove, std::move(callback));
+  }
+  template <typename T> ObserverId onReplace(ObserverCallback callback) {
+    return addObserver(ComponentTypeManager::getId<T>(),
+                       ObserverEvent::Replace, std::move(callback));
+  }
+
+  void removeObserver(ObserverId id) {
+    observed.reset();
+    for (Observer &observer : observers) {
+      if (observer.id == id) {
+        observer.callback = nullptr;
+      } else if (observer.callback) {
+        observed.set(observer.componentId);
+      }
+    }
+  }
+
+  void flushObservers() {
+    std::erase_if(observers, [](const Observer &observer) {
+      return !observer.callback;
+    });
+    Signature pending = pendingObserved;
+    pendingObserved.reset();
+    for (uint32_t id = 0; id < MAX_COMPONENTS; id++) {
+      if (pending.test(id)) {
+        deliverObserved(static_cast<uint8_t>(id));
       }
     }
-    return results;
   }
 
 private:
-  Entity nextEntity = 1;
-  std::unordered_map<Entity, Signature> signatures;
-  std::unordered_map<std::type_index, std::shared_ptr<IComponentStore>> stores;
+  template <typename... Components> friend class View;
+  template <typename T> friend class SpatialCompactor;
+  friend class WorldSnapshot;
+
+  struct EntityLocation {
+    Archetype *archetype = nullptr;
+    uint32_t row = 0;
+  };
+
+  // Per-slot tables, indexed by entityIndex(). Slot 0 is reserved so that
+  // NULL_ENTITY never refers to a live entity.
+  uint32_t nextIndex = 1;
+  std::vector<Entity> handles{NULL_ENTITY};
+  std::vector<Signature> signatures{Signature(0)};
+  std::vector<Entity> freeList; // Next handle to hand out for each free slot
+  // Non-archetype stores, indexed by ComponentTypeManager id
+  std::unique_ptr<IComponentStore> stores[MAX_COMPONENTS];
+
+  std::vector<EntityLocation> locations{EntityLocation{}};
+  std::unordered_map<Signature, std::unique_ptr<Archetype>> archetypes;
+  std::vector<Archetype *> archetypeList;
+
+  std::unordered_map<QueryKey, std::unique_ptr<Query>, QueryKeyHash> queries;
+  std::vector<Query *> queryList;
+  // Cached queries by QueryTypeManager id, in pages that never move, so a
+  // lookup needs no lock while another thread registers a query
+  static constexpr size_t QUERY_PAGE_SIZE = 64;
+  static constexpr size_t MAX_QUERY_PAGES = 256;
+  struct QueryPage {
+    std::atomic<Query *> slots[QUERY_PAGE_SIZE] = {};
+  };
+  std::atomic<QueryPage *> queryPages[MAX_QUERY_PAGES] = {};
+  std::vector<std::unique_ptr<QueryPage>> ownedQueryPages;
+  std::mutex queryMutex; // Held while registering a query
+
+  bool batching = false;
+  std::vector<Entity> batchEntities;    // Entities touched in this batch
+  std::vector<Signature> batchPrevious; // Their signatures before it
+  std::vector<uint32_t> batchSlots;     // Entity index -> position + 1
+
+  std::atomic<uint32_t> changeTick{0};
+
+  struct Observer {
+    ObserverId id;
+    uint8_t componentId;
+    ObserverEvent event;
+    ObserverCallback callback; // Null once removed
+  };
+  struct ObservedChange {
+    Entity entity;
+    bool existed; // Whether the entity had the component before the change
+  };
+  std::vector<Observer> observers;
+  ObserverId nextObserverId = 1;
+  Signature observed;        // Components with at least one observer
+  Signature pendingObserved; // Components with undelivered changes
+  std::vector<ObservedChange> observedChanges[MAX_COMPONENTS];
+  std::vector<Entity> observerLists[3]; // Per ObserverEvent, reused
+
+  ObserverId addObserver(uint8_t componentId, ObserverEvent event,
+                         ObserverCallback callback) {
+    ObserverId id = nextObserverId++;
+    observers.push_back({id, componentId, event, std::move(callback)});
+    observed.set(componentId);
+    return id;
+  }
+
+  void recordObserved(Entity e, uint8_t componentId, bool existed) {
+    observedChanges[componentId].push_back({e, existed});
+    pendingObserved.set(componentId);
+  }
+
+  void recordObserved(Entity e, const Signature &components, bool existed) {
+    uint64_t bits = (components & observed).to_ullong();
+    while (bits) {
+      recordObserved(e, static_cast<uint8_t>(std::countr_zero(bits)),
+                     existed);
+      bits &= bits - 1;
+    }
+  }
+
+  void deliverObserved(uint8_t componentId) {
+    std::vector<ObservedChange> changes;
+    changes.swap(observedChanges[componentId]);
+    // The first change recorded for an entity tells whether it had the
+    // component before the batch; its signature tells whether it has it now
+    std::stable_sort(changes.begin(), changes.end(),
+                     [](const ObservedChange &a, const ObservedChange &b) {
+                       return a.entity < b.entity;
+                     });
+    for (auto &list : observerLists) {
+      list.clear();
+    }
+    for (size_t i = 0; i < changes.size(); i++) {
+      if (i > 0 && changes[i].entity == changes[i - 1].entity)
+        continue;
+      Entity e = changes[i].entity;
+      bool existed = changes[i].existed;
+      bool exists =
+          isAlive(e) && signatures[entityIndex(e)].test(componentId);
+      if (existed && exists) {
+        observerLists[size_t(ObserverEvent::Replace)].push_back(e);
+      } else if (existed) {
+        observerLists[size_t(ObserverEvent::Remove)].push_back(e);
+      } else if (exists) {
+        observerLists[size_t(ObserverEvent::Add)].push_back(e);
+      }
+    }
+    // Keep the buffer's capacity for the next batch
+    changes.clear();
+    if (observedChanges[componentId].empty()) {
+      observedChanges[componentId].swap(changes);
+    }
+
+    for (ObserverEvent event :
+         {ObserverEvent::Remove, ObserverEvent::Add, ObserverEvent::Replace}) {
+      std::vector<Entity> &list = observerLists[size_t(event)];
+      if (list.empty())
+        continue;
+      // Callbacks may add observers, so index and call a copy
+      size_t count = observers.size();
+      for (size_t i = 0; i < count; i++) {
+        if (observers[i].componentId == componentId &&
+            observers[i].event == event && observers[i].callback) {
+          ObserverCallback callback = observers[i].callback;
+          callback(*this, list);
+        }
+      }
+    }
+  }
 
   // Helper to get or create a store for a specific type
-  template <typename T> std::shared_ptr<ComponentStore<T>> getStore() {
-    auto type = std::type_index(typeid(T));
-    if (!stores.contains(type)) {
-      stores[type] = std::make_shared<ComponentStore<T>>();
+  template <typename T> ComponentStore<T> &getStore() {
+    std::unique_ptr<IComponentStore> &store =
+        stores[ComponentTypeManager::getId<T>()];
+    if (!store) {
+      store = std::make_unique<ComponentStore<T>>();
+    }
+    return static_cast<ComponentStore<T> &>(*store);
+  }
+
+  template <typename Term> static void addQueryTerm(QueryKey &key) {
+    uint8_t id =
+        ComponentTypeManager::getId<typename ViewTerm<Term>::Component>();
+    if constexpr (ViewTerm<Term>::required) {
+      key.required.set(id);
+    }
+    if constexpr (ViewTerm<Term>::excluded) {
+      key.excluded.set(id);
+    }
+  }
+
+  // The slot of a stale handle may belong to a newer entity by now
+  void requireAlive(Entity e) const {
+    if (!isAlive(e)) {
+      throw std::out_of_range("Entity is not alive!");
+    }
+  }
+
+  Query *cachedQuery(size_t id) const {
+    size_t page = id / QUERY_PAGE_SIZE;
+    if (page >= MAX_QUERY_PAGES)
+      return nullptr;
+    QueryPage *slots = queryPages[page].load(std::memory_order_acquire);
+    if (!slots)
+      return nullptr;
+    return slots->slots[id % QUERY_PAGE_SIZE].load(std::memory_order_acquire);
+  }
+
+  // Registers the query for key under id. Two threads asking for the same
+  // id both get the one query.
+  Query *cacheQuery(size_t id, const QueryKey &key) {
+    std::lock_guard<std::mutex> lock(queryMutex);
+    size_t page = id / QUERY_PAGE_SIZE;
+    if (page >= MAX_QUERY_PAGES) {
+      throw std::runtime_error("Exceeded maximum query type count!");
+    }
+    QueryPage *slots = queryPages[page].load(std::memory_order_relaxed);
+    if (!slots) {
+      ownedQueryPages.push_back(std::make_unique<QueryPage>());
+      slots = ownedQueryPages.back().get();
+      queryPages[page].store(slots, std::memory_order_release);
+    }
+    Query *query = registerQuery(key);
+    slots->slots[id % QUERY_PAGE_SIZE].store(query, std::memory_order_release);
+    return query;
+  }
+
+  Query *registerQuery(const QueryKey &key) {
+    auto it = queries.find(key);
+    if (it != queries.end())
+      return it->second.get();
+
+    auto query = std::make_unique<Query>(key.required, key.excluded);
+    fillQuery(*query);
+    Query *ptr = query.get();
+    queries.emplace(key, std::move(query));
+    queryList.push_back(ptr);
+    return ptr;
+  }
+
+  // Adds every live entity that matches, scanning the signature table
+  void fillQuery(Query &query) {
+    forEachSignatureMatch(signatures.data(), signatures.size(),
+                          query.getRequired(), query.getExcluded(),
+                          [&](size_t index) {
+                            if (handles[index] != NULL_ENTITY) {
+                              query.insert(handles[index]);
+                            }
+                            return true;
+                          });
+  }
+
+  // A fresh handle with an empty signature, not yet in any query
+  Entity allocateHandle() {
+    Entity id;
+    if (!freeList.empty()) {
+      id = freeList.back();
+      freeList.pop_back();
+    } else {
+      if (nextIndex > ENTITY_INDEX_MASK) {
+        throw std::runtime_error("Exceeded maximum entity count!");
+      }
+      id = makeEntity(nextIndex++, 0);
+      handles.push_back(NULL_ENTITY);
+      signatures.emplace_back();
+      locations.emplace_back();
+    }
+
+    uint32_t index = entityIndex(id);
+    handles[index] = id;
+    signatures[index] = Signature(0);
+    return id;
+  }
+
+  std::vector<Entity> spawnPrefab(const Prefab &prefab, size_t count,
+                                  uint8_t overrideId, bool overrideArchetype);
+
+  // Fills every cached query from scratch; they must be empty
+  void populateQueries() {
+    for (Query *query : queryList) {
+      fillQuery(*query);
+    }
+  }
+
+  void updateQueries(Entity e, const Signature &previous) {
+    if (batching) {
+      uint32_t index = entityIndex(e);
+      if (batchSlots.size() <= index) {
+        batchSlots.resize(index + 1);
+      }
+      if (!batchSlots[index]) {
+        batchEntities.push_back(e);
+        batchPrevious.push_back(previous);
+        batchSlots[index] = static_cast<uint32_t>(batchEntities.size());
+      }
+      return;
+    }
+    for (Query *query : queryList) {
+      bool before = query->matches(previous);
+      bool after = query->matches(signatures[entityIndex(e)]);
+      if (before && !after) {
+        query->erase(e);
+      } else if (!before && after) {
+        query->insert(e);
+      }
+    }
+  }
+
+  Archetype *getArchetype(const Signature &signature) {
+    auto it = archetypes.find(signature);
+    if (it != archetypes.end())
+      return it->second.get();
+
+    auto archetype = std::make_unique<Archetype>(signature);
+    Archetype *ptr = archetype.get();
+    archetypes.emplace(signature, std::move(archetype));
+    archetypeList.push_back(ptr);
+    return ptr;
+  }
+
+  // Moves e's archetype components into dst (nullptr drops them all).
+  // Columns dst has but the old archetype lacks are left unconstructed for
+  // the caller to fill in.
+  uint32_t moveEntity(Entity e, Archetype *dst) {
+    EntityLocation &loc = locations[entityIndex(e)];
+    Archetype *src = loc.archetype;
+    uint32_t row = 0;
+
+    if (dst) {
+      row = dst->allocateRow(e);
+    }
+    if (src) {
+      if (dst) {
+        for (size_t c = 0; c < src->getColumns().size(); c++) {
+          uint8_t id = src->getColumns()[c].componentId;
+          if (!dst->hasColumn(id))
+            continue;
+          src->getColumns()[c].info->moveConstruct(dst->slotFor(id, row),
+                                                   src->slot(c, loc.row));
+          dst->ticksFor(id, row) = src->ticksAt(c, loc.row);
+        }
+      }
+      Entity moved = src->removeRow(loc.row);
+      if (moved) {
+        locations[entityIndex(moved)].row = loc.row;
+      }
+    }
+
+    loc.archetype = dst;
+    loc.row = row;
+    return row;
+  }
+};
+
+// Resolves component stores once and walks matching entities, handing the
+// callback typed references: view<A, const B, Optional<C>>().each(
+// [](Entity, A &, const B &, C *) {...}). Mutable terms mark the component
+// changed for every entity visited; const terms only read. When every
+// component the callback reads is archetype-stored the walk goes chunk by
+// chunk over the columns, testing tags and store components per row against
+// the signature table; otherwise it follows the cached query. A callback
+// returning bool can stop early by returning false. Adding or removing
+// components while iterating is not supported.
+template <typename... Terms> class View {
+  static_assert(sizeof...(Terms) > 0, "View needs at least one type");
+
+  template <typename Term>
+  using ComponentOf = typename ViewTerm<Term>::Component;
+
+  template <typename Term>
+  static constexpr bool stored = isArchetypeStored<ComponentOf<Term>>;
+
+  // Whether the term reads the component's data or change ticks
+  template <typename Term>
+  static constexpr bool readsData =
+      (ViewTerm<Term>::passed || ViewTerm<Term>::filter) &&
+      !isTag<ComponentOf<Term>>;
+
+  template <typename Term>
+  static constexpr bool signatureOnly =
+      (ViewTerm<Term>::required || ViewTerm<Term>::excluded) && !stored<Term>;
+
+  // Chunks are walked when all data lives in archetypes and some required
+  // component does too, so every match sits in a chunk
+  static constexpr bool allArchetype =
+      ((!readsData<Terms> || stored<Terms>) && ...) &&
+      ((ViewTerm<Terms>::required && stored<Terms>) || ...);
+  static constexpr bool rowChecks = (signatureOnly<Terms> || ...);
+  static constexpr bool hasFilter = (ViewTerm<Terms>::filter || ...);
+
+  // Rows whose signatures are gathered and matched at once
+  static constexpr uint32_t ROW_BLOCK = 256;
+
+  template <typename Term>
+  using StorePtr =
+      std::conditional_t<readsData<Term> && !stored<Term>,
+                         ComponentStore<ComponentOf<Term>> *, std::nullptr_t>;
+  template <typename Term>
+  using ColumnPtr =
+      std::conditional_t<readsData<Term> && stored<Term>, ComponentOf<Term> *,
+                         std::nullptr_t>;
+
+  using Indices = std::index_sequence_for<Terms...>;
+  template <size_t> using TicksPtr = ComponentTicks *;
+  template <size_t I>
+  using TermAt = std::tuple_element_t<I, std::tuple<Terms...>>;
+
+public:
+  View(ECS2 &world, uint32_t since)
+      : world(world), since(since), tick(world.writeTick()) {
+    (addTerm<Terms>(), ...);
+    if constexpr (!allArchetype) {
+      entities = &world.query<Terms...>();
+    }
+    stores = std::make_tuple(resolveStore<Terms>()...);
+  }
+
+  template <typename F> void each(F &&f) { each(f, Indices{}); }
+
+  // Calls f(ArchetypeChunkView &) for every non-empty chunk whose archetype
+  // stores all of the view's components, for systems that want the raw
+  // columns. Filter terms are not applied per row; check chunk.ticks<T>().
+  template <typename F> void eachChunk(F &&f) {
+    static_assert(allArchetype && !rowChecks,
+                  "eachChunk requires archetype-stored components");
+    for (Archetype *archetype : world.archetypeList) {
+      if (!matches(*archetype))
+        continue;
+      for (size_t c = 0; c < archetype->chunkCount(); c++) {
+        ArchetypeChunkView chunk(archetype, c, tick);
+        f(chunk);
+      }
+    }
+  }
+
+private:
+  template <typename Term> void addTerm() {
+    uint8_t id = ComponentTypeManager::getId<ComponentOf<Term>>();
+    if constexpr (ViewTerm<Term>::required) {
+      (stored<Term> ? storedRequired : rowRequired).set(id);
+    }
+    if constexpr (ViewTerm<Term>::excluded) {
+      (stored<Term> ? storedExcluded : rowExcluded).set(id);
+    }
+  }
+
+  bool matches(const Archetype &archetype) const {
+    return (archetype.getSignature() & (storedRequired | storedExcluded)) ==
+           storedRequired;
+  }
+
+  template <typename F, size_t... I>
+  void each(F &f, std::index_sequence<I...>) {
+    if constexpr (allArchetype) {
+      for (Archetype *archetype : world.archetypeList) {
+        if (!matches(*archetype))
+          continue;
+        for (size_t c = 0; c < archetype->chunkCount(); c++) {
+          const Entity *ids = archetype->entities(c);
+          std::tuple<ColumnPtr<Terms>...> columns(
+              columnOf<Terms>(*archetype, c)...);
+          std::tuple<TicksPtr<I>...> ticks(
+              ticksColumn<Terms>(*archetype, c)...);
+          auto visit = [&](uint32_t i) {
+            if (!(passesRow<Terms>(std::get<I>(ticks), i) && ...))
+              return true;
+            (stampRow<Terms>(std::get<I>(ticks), i), ...);
+            return call(f, ids[i],
+                        rowArgument<Terms>(std::get<I>(columns), i)...);
+          };
+
+          uint32_t count = archetype->chunkSize(c);
+          if constexpr (rowChecks) {
+            for (uint32_t first = 0; first < count; first += ROW_BLOCK) {
+              uint32_t rows = std::min(count - first, ROW_BLOCK);
+              Signature block[ROW_BLOCK];
+              for (uint32_t i = 0; i < rows; i++) {
+                block[i] = world.signatures[entityIndex(ids[first + i])];
+              }
+              if (!forEachSignatureMatch(
+                      block, rows, rowRequired, rowExcluded,
+                      [&](size_t i) { return visit(first + uint32_t(i)); }))
+                return;
+            }
+          } else {
+            for (uint32_t i = 0; i < count; i++) {
+              if (!visit(i))
+                return;
+            }
+          }
+        }
+      }
+    } else {
+      for (Entity e : *entities) {
+        if constexpr (hasFilter) {
+          if (!(passesEntity<Terms, I>(e) && ...))
+            continue;
+        }
+        (stampEntity<Terms, I>(e), ...);
+        if (!call(f, e, entityArgument<Terms, I>(e)...))
+          return;
+      }
+    }
+  }
+
+  template <typename Term> StorePtr<Term> resolveStore() {
+    if constexpr (std::is_same_v<StorePtr<Term>, std::nullptr_t>) {
+      return nullptr;
+    } else {
+      return &world.template getStore<ComponentOf<Term>>();
+    }
+  }
+
+  template <typename T> static T &tagInstance() {
+    // Tags have no per-entity data; every match shares one instance
+    static T tag;
+    return tag;
+  }
+
+  // -- Chunk walk --
+
+  template <typename Term>
+  static ColumnPtr<Term> columnOf(Archetype &archetype, size_t chunk) {
+    if constexpr (std::is_same_v<ColumnPtr<Term>, std::nullptr_t>) {
+      return nullptr;
+    } else {
+      return archetype.template column<ComponentOf<Term>>(chunk);
+    }
+  }
+
+  // nullptr when the term neither filters nor writes, or for an Optional
+  // term the archetype does not store
+  template <typename Term>
+  static ComponentTicks *ticksColumn(Archetype &archetype, size_t chunk) {
+    if constexpr ((ViewTerm<Term>::filter || ViewTerm<Term>::writes) &&
+                  stored<Term>) {
+      return archetype.template ticks<ComponentOf<Term>>(chunk);
+    } else {
+      return nullptr;
+    }
+  }
+
+  template <typename Term>
+  bool passesRow(const ComponentTicks *ticks, uint32_t row) const {
+    if constexpr (ViewTerm<Term>::filter) {
+      return ViewTerm<Term>::passes(ticks[row], since);
+    } else {
+      return true;
+    }
+  }
+
+  template <typename Term> void stampRow(ComponentTicks *ticks, uint32_t row) {
+    if constexpr (ViewTerm<Term>::writes) {
+      if (ticks) {
+        ticks[row].changed = tick;
+      }
+    }
+  }
+
+  template <typename Term>
+  static auto rowArgument(ColumnPtr<Term> column, uint32_t row) {
+    if constexpr (!ViewTerm<Term>::passed) {
+      return std::tuple<>();
+    } else if constexpr (ViewTerm<Term>::optional) {
+      using Pointer = typename ViewTerm<Term>::Pointer;
+      return std::tuple<Pointer>(column ? column + row : nullptr);
+    } else if constexpr (isTag<Term>) {
+      return std::tuple<Term &>(tagInstance<ComponentOf<Term>>());
+    } else {
+      return std::tuple<Term &>(column[row]);
+    }
+  }
+
+  // -- Query walk --
+
+  template <size_t I> bool has(Entity e) const {
+    return world.signatures[entityIndex(e)].test(
+        ComponentTypeManager::getId<ComponentOf<TermAt<I>>>());
+  }
+
+  template <size_t I> auto &fetch(Entity e) {
+    using T = ComponentOf<TermAt<I>>;
+    if constexpr (isTag<T>) {
+      return tagInstance<T>();
+    } else if constexpr (isArchetypeStored<T>) {
+      const auto &loc = world.locations[entityIndex(e)];
+      return loc.archetype->template get<T>(loc.row);
+    } else {
+      return std::get<I>(stores)->get(e);
+    }
+  }
+
+  template <size_t I> ComponentTicks &ticksOf(Entity e) {
+    using T = ComponentOf<TermAt<I>>;
+    if constexpr (isArchetypeStored<T>) {
+      const auto &loc = world.locations[entityIndex(e)];
+      return loc.archetype->ticksFor(ComponentTypeManager::getId<T>(),
+                                     loc.row);
+    } else {
+      return std::get<I>(stores)->ticks(e);
+    }
+  }
+
+  template <typename Term, size_t I> bool passesEntity(Entity e) {
+    if constexpr (ViewTerm<Term>::filter) {
+      return ViewTerm<Term>::passes(ticksOf<I>(e), since);
+    } else {
+      return true;
+    }
+  }
+
+  template <typename Term, size_t I> void stampEntity(Entity e) {
+    if constexpr (ViewTerm<Term>::writes) {
+      if (!ViewTerm<Term>::optional || has<I>(e)) {
+        ticksOf<I>(e).changed = tick;
+      }
+    }
+  }
+
+  template <typename Term, size_t I> auto entityArgument(Entity e) {
+    if constexpr (!ViewTerm<Term>::passed) {
+      return std::tuple<>();
+    } else if constexpr (ViewTerm<Term>::optional) {
+      using Pointer = typename ViewTerm<Term>::Pointer;
+      return std::tuple<Pointer>(has<I>(e) ? &fetch<I>(e) : nullptr);
+    } else {
+      return std::tuple<Term &>(fetch<I>(e));
+    }
+  }
+
+  template <typename F, typename... Args>
+  static bool call(F &f, Entity e, Args &&...args) {
+    return std::apply(
+        [&](auto &&...unpacked) {
+          return invoke(f, std::forward<decltype(unpacked)>(unpacked)...);
+        },
+        std::tuple_cat(std::tuple<Entity>(e), std::forward<Args>(args)...));
+  }
+
+  template <typename F, typename... Args>
+  static bool invoke(F &f, Args &&...args) {
+    if constexpr (std::is_same_v<std::invoke_result_t<F &, Args...>, bool>) {
+      return f(std::forward<Args>(args)...);
+    } else {
+      f(std::forward<Args>(args)...);
+      return true;
     }
-    return std::static_pointer_cast<ComponentStore<T>>(stores[type]);
   }
+
+  ECS2 &world;
+  // Required and excluded components the archetype signature answers, and
+  // those (tags, store components) only the entity signature does
+  Signature storedRequired;
+  Signature storedExcluded;
+  Signature rowRequired;
+  Signature rowExcluded;
+  uint32_t since; // Filters pass for ticks newer than this
+  uint32_t tick;  // Stamped into components accessed mutably
+  const std::vector<Entity> *entities = nullptr;
+  std::tuple<StorePtr<Terms>...> stores;
 };
+
+inline std::vector<Entity> ECS2::migrate(std::span<const Entity> entities,
+                                         ECS2 &from, ECS2 &to) {
+  if (&from == &to) {
+    throw std::logic_error("Cannot migrate entities into their own world!");
+  }
+  if (from.batching || to.batching) {
+    throw std::logic_error("Cannot migrate entities during a batch!");
+  }
+  std::vector<Entity> moved(entities.size(), NULL_ENTITY);
+
+  // Entities with the same signature share an archetype and query
+  // membership, so each group is placed and indexed in one go
+  std::vector<std::pair<Signature, std::vector<size_t>>> groups;
+  std::unordered_map<Signature, size_t> groupOf;
+  std::vector<uint8_t> seen(from.handles.size(), 0);
+  for (size_t i = 0; i < entities.size(); i++) {
+    Entity e = entities[i];
+    if (!from.isAlive(e) || seen[entityIndex(e)])
+      continue;
+    seen[entityIndex(e)] = 1;
+    const Signature &signature = from.signatures[entityIndex(e)];
+    auto [it, inserted] = groupOf.try_emplace(signature, groups.size());
+    if (inserted) {
+      groups.emplace_back(signature, std::vector<size_t>{});
+    }
+    groups[it->second].second.push_back(i);
+  }
+
+  size_t count = 0;
+  for (const auto &[signature, members] : groups)
+    count += members.size();
+  size_t fresh = count > to.freeList.size() ? count - to.freeList.size() : 0;
+  if (to.nextIndex + fresh > size_t(ENTITY_INDEX_MASK) + 1) {
+    throw std::runtime_error("Exceeded maximum entity count!");
+  }
+  to.handles.reserve(to.handles.size() + fresh);
+  to.signatures.reserve(to.signatures.size() + fresh);
+  to.locations.reserve(to.locations.size() + fresh);
+
+  uint32_t tick = to.writeTick();
+  for (const auto &[signature, members] : groups) {
+    for (size_t i : members) {
+      moved[i] = to.allocateHandle();
+      to.signatures[entityIndex(moved[i])] = signature;
+      to.recordObserved(moved[i], signature, false);
+    }
+
+    Entity first = entities[members[0]];
+    Archetype *src = from.locations[entityIndex(first)].archetype;
+    if (src) {
+      Archetype *dst = to.getArchetype(src->getSignature());
+      if (members.size() == src->size() && dst->size() == 0) {
+        // The whole archetype moves; keep its rows where they are
+        dst->adoptRows(*src);
+        for (size_t i : members) {
+          auto &loc = from.locations[entityIndex(entities[i])];
+          Entity *ids = dst->entities(loc.row / dst->capacity());
+          ids[loc.row % dst->capacity()] = moved[i];
+          to.locations[entityIndex(moved[i])] = {dst, loc.row};
+          for (size_t c = 0; c < dst->getColumns().size(); c++) {
+            dst->ticksAt(c, loc.row) = {tick, tick};
+          }
+          loc = {};
+        }
+      } else {
+        dst->reserve(static_cast<uint32_t>(members.size()));
+        for (size_t i : members) {
+          uint32_t row = dst->allocateRow(moved[i]);
+          to.locations[entityIndex(moved[i])] = {dst, row};
+        }
+        for (size_t c = 0; c < src->getColumns().size(); c++) {
+          const Archetype::Column &column = src->getColumns()[c];
+          for (size_t i : members) {
+            uint32_t srcRow = from.locations[entityIndex(entities[i])].row;
+            uint32_t dstRow = to.locations[entityIndex(moved[i])].row;
+            column.info->moveConstruct(dst->slotFor(column.componentId, dstRow),
+                                       src->slot(c, srcRow));
+            dst->ticksFor(column.componentId, dstRow) = {tick, tick};
+          }
+        }
+      }
+    }
+
+    for (uint32_t id = 0; id < MAX_COMPONENTS; id++) {
+      IComponentStore *store = from.stores[id].get();
+      if (!signature.test(id) || !store)
+        continue;
+      std::unique_ptr<IComponentStore> &target = to.stores[id];
+      if (!target) {
+        target = store->createEmpty();
+      }
+      target->reserve(members.size());
+      for (size_t i : members) {
+        store->moveTo(entities[i], *target, moved[i], tick);
+      }
+    }
+
+    for (Query *query : to.queryList) {
+      if (query->matches(signature)) {
+        for (size_t i : members) {
+          query->insert(moved[i]);
+        }
+      }
+    }
+  }
+
+  // Archetype rows still hold moved-from values, which destroying the
+  // entities in `from` cleans up
+  for (const auto &[signature, members] : groups) {
+    for (size_t i : members) {
+      from.destroyEntity(entities[i]);
+    }
+  }
+  return moved;
+}
+
+template <typename... Terms> View<Terms...> ECS2::view() {
+  return View<Terms...>(*this, lastRunTick());
+}
+
+template <typename... Terms> View<Terms...> ECS2::view(uint32_t since) {
+  return View<Terms...>(*this, since);
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// A component set resolved once and stamped out many times with
+// ECS2::spawnBatch. Every spawned entity gets a copy of each component.
+class Prefab {
+public:
+  template <typename T> Prefab &set(T component) {
+    static_assert(std::is_copy_constructible_v<T>,
+                  "Prefab components are copied into every instance");
+    uint8_t id = ComponentTypeManager::getId<T>();
+    Entry entry;
+    entry.componentId = id;
+    entry.archetype = isArchetypeStored<T>;
+    entry.value = std::make_shared<const T>(std::move(component));
+    if constexpr (!isArchetypeStored<T> && !isTag<T>) {
+      entry.createStore = [] {
+        return std::unique_ptr<IComponentStore>(new ComponentStore<T>());
+      };
+    }
+
+    if (signature.test(id)) {
+      for (Entry &existing : entries) {
+        if (existing.componentId == id)
+          existing = std::move(entry);
+      }
+    } else {
+      entries.push_back(std::move(entry));
+      signature.set(id);
+    }
+    return *this;
+  }
+
+  template <typename T> bool has() const {
+    return signature.test(ComponentTypeManager::getId<T>());
+  }
+
+  template <typename T> const T &get() const {
+    uint8_t id = ComponentTypeManager::getId<T>();
+    for (const Entry &entry : entries) {
+      if (entry.componentId == id)
+        return *static_cast<const T *>(entry.value.get());
+    }
+    throw std::out_of_range("Prefab does not have component!");
+  }
+
+  const Signature &getSignature() const { return signature; }
+
+private:
+  friend class ECS2;
+
+  struct Entry {
+    uint8_t componentId = 0;
+    bool archetype = false;
+    std::shared_ptr<const void> value;
+    // Store-backed components only; lets ECS2 create the typed store
+    std::unique_ptr<IComponentStore> (*createStore)() = nullptr;
+  };
+
+  Signature signature;
+  std::vector<Entry> entries;
+};
+
+inline std::vector<Entity> ECS2::spawnPrefab(const Prefab &prefab,
+                                             size_t count, uint8_t overrideId,
+                                             bool overrideArchetype) {
+  Signature signature = prefab.signature;
+  Signature archetypeSignature;
+  for (const Prefab::Entry &entry : prefab.entries) {
+    if (entry.archetype)
+      archetypeSignature.set(entry.componentId);
+  }
+  if (overrideId < MAX_COMPONENTS) {
+    signature.set(overrideId);
+    if (overrideArchetype)
+      archetypeSignature.set(overrideId);
+  }
+
+  size_t fresh = count > freeList.size() ? count - freeList.size() : 0;
+  if (nextIndex + fresh > size_t(ENTITY_INDEX_MASK) + 1) {
+    throw std::runtime_error("Exceeded maximum entity count!");
+  }
+  handles.reserve(handles.size() + fresh);
+  signatures.reserve(signatures.size() + fresh);
+  locations.reserve(locations.size() + fresh);
+
+  std::vector<Entity> spawned(count);
+  for (size_t i = 0; i < count; i++) {
+    spawned[i] = allocateHandle();
+    signatures[entityIndex(spawned[i])] = signature;
+    recordObserved(spawned[i], signature, false);
+  }
+
+  uint32_t tick = writeTick();
+  if (archetypeSignature.any()) {
+    Archetype *archetype = getArchetype(archetypeSignature);
+    archetype->reserve(static_cast<uint32_t>(count));
+    for (Entity e : spawned) {
+      uint32_t row = archetype->allocateRow(e);
+      locations[entityIndex(e)] = {archetype, row};
+      for (const Prefab::Entry &entry : prefab.entries) {
+        if (!entry.archetype || entry.componentId == overrideId)
+          continue;
+        ComponentTypeManager::getInfo(entry.componentId)
+            .copyConstruct(archetype->slotFor(entry.componentId, row),
+                           entry.value.get());
+        archetype->ticksFor(entry.componentId, row) = {tick, tick};
+      }
+    }
+  }
+
+  for (const Prefab::Entry &entry : prefab.entries) {
+    if (!entry.createStore || entry.componentId == overrideId)
+      continue;
+    std::unique_ptr<IComponentStore> &store = stores[entry.componentId];
+    if (!store) {
+      store = entry.createStore();
+    }
+    store->reserve(count);
+    for (Entity e : spawned) {
+      store->addCopy(e, entry.value.get(), tick);
+    }
+  }
+
+  // Every instance has the same signature, so each query is tested once
+  for (Query *query : queryList) {
+    if (query->matches(signature)) {
+      for (Entity e : spawned) {
+        query->insert(e);
+      }
+    }
+  }
+  return spawned;
+}
+
+inline std::vector<Entity> ECS2::spawnBatch(const Prefab &prefab,
+                                            size_t count) {
+  return spawnPrefab(prefab, count, MAX_COMPONENTS, false);
+}
+
+template <typename T>
+std::vector<Entity> ECS2::spawnBatch(const Prefab &prefab,
+                                     std::span<const T> instances) {
+  uint8_t id = ComponentTypeManager::getId<T>();
+  std::vector<Entity> spawned =
+      spawnPrefab(prefab, instances.size(), id, isArchetypeStored<T>);
+
+  uint32_t tick = writeTick();
+  if constexpr (isTag<T>) {
+    (void)tick;
+  } else if constexpr (isArchetypeStored<T>) {
+    for (size_t i = 0; i < spawned.size(); i++) {
+      const EntityLocation &loc = locations[entityIndex(spawned[i])];
+      new (loc.archetype->slotFor(id, loc.row)) T(instances[i]);
+      loc.archetype->ticksFor(id, loc.row) = {tick, tick};
+    }
+  } else {
+    ComponentStore<T> &store = getStore<T>();
+    store.reserve(spawned.size());
+    for (size_t i = 0; i < spawned.size(); i++) {
+      store.add(spawned[i], instances[i], tick);
+    }
+  }
+  return spawned;
+}
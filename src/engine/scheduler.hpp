@@ -0,0 +1,412 @@
+#pragma once
+
+#include "engine/command_buffer.hpp"
+#include "engine/ecs2.hpp"
+#include "util/logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Component access a system declares when it is registered
+template <typename... Components> struct Reads {};
+template <typename... Components> struct Writes {};
+
+// Systems that touch the GL context must stay on the thread that owns it
+enum class SystemThread { Any, Main };
+
+// How often a system runs and how long a run may take
+struct SystemSchedule {
+  float rate = 0.0f;     // Runs per second; 0 runs every frame
+  float budgetMs = 0.0f; // Time a run should stay within; 0 for no budget
+};
+
+// Timing of one system, as of the last run() call
+struct SystemStats {
+  std::string name;
+  float lastMs = 0.0f;    // Duration of the latest run
+  float averageMs = 0.0f; // Moving average over recent runs
+  float worstMs = 0.0f;
+  uint64_t runs = 0;
+  uint64_t skips = 0;    // Frames left out to keep to the rate
+  uint64_t overruns = 0; // Runs that took longer than the budget
+};
+
+// Runs registered systems once per frame. Two systems conflict when one
+// writes a component the other reads or writes; conflicting systems run in
+// registration order, everything else may run at the same time on the
+// worker pool. Main-pinned systems only ever run inside run() on the
+// calling thread.
+//
+// Every system run gets its own world tick. Writes the system makes are
+// stamped with it and views inside the system filter Changed<T>/Added<T>
+// against the system's previous run, so each change is seen exactly once.
+//
+// The first frame runs serially on the calling thread so systems can lazily
+// create the component stores they use. Stores are created without a lock,
+// so every component a system touches must be reached on its first run;
+// build views unconditionally rather than inside branches. Queries are
+// registered under a lock and may first appear on any frame. Systems must
+// not make structural changes to the world directly; they record them into
+// commands().local() and run() applies everything in one batch once every
+// system has finished, in registration order of the systems that recorded.
+//
+// World observers are flushed before the first system starts and again after
+// the commands are applied, so systems see changes made between frames and
+// every structural change of the frame is delivered before the next one.
+//
+// A system with a rate sits out the frames in between; its views still see
+// every change since its last run. A system with a budget can spread its
+// work over several runs with TimeSlice, and runs that exceed the budget are
+// counted in stats() and logged at most once a second per system.
+class Scheduler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Scheduler(ECS2 &world, unsigned workerCount = defaultWorkerCount())
+      : world(world) {
+    for (unsigned i = 0; i < workerCount; i++) {
+      workers.emplace_back([this] { workerLoop(); });
+    }
+  }
+
+  ~Scheduler() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  template <typename... R, typename... W>
+  void addSystem(const std::string &name, Reads<R...>, Writes<W...>,
+                 std::function<void(ECS2 &)> update,
+                 SystemThread thread = SystemThread::Any,
+                 SystemSchedule schedule = {}) {
+    SystemEntry entry;
+    entry.name = name;
+    entry.update = std::move(update);
+    entry.thread = thread;
+    entry.schedule = schedule;
+    ((entry.reads.set(ComponentTypeManager::getId<R>())), ...);
+    ((entry.writes.set(ComponentTypeManager::getId<W>())), ...);
+    systems.push_back(std::move(entry));
+    systemStats.push_back(SystemStats{name});
+    graphDirty = true;
+  }
+
+  void run() {
+    if (graphDirty) {
+      buildGraph();
+    }
+    world.flushObservers();
+
+    Clock::time_point now = Clock::now();
+    for (auto &system : systems) {
+      system.due = firstFrame || isDue(system, now);
+    }
+
+    if (firstFrame || workers.empty()) {
+      for (size_t i = 0; i < systems.size(); i++) {
+        runSystem(i);
+      }
+      firstFrame = false;
+      commandQueue.flush(world);
+      world.flushObservers();
+      reportOverruns(now);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      remaining = systems.size();
+      for (size_t i = 0; i < systems.size(); i++) {
+        pendingDeps[i] = systems[i].dependencyCount;
+        if (pendingDeps[i] == 0) {
+          enqueue(i);
+        }
+      }
+    }
+    workAvailable.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (remaining > 0) {
+      size_t next;
+      if (!mainQueue.empty()) {
+        next = mainQueue.front();
+        mainQueue.pop_front();
+      } else if (!workerQueue.empty()) {
+        // Nothing pinned is ready, so help out with pool work
+        next = workerQueue.front();
+        workerQueue.pop_front();
+      } else {
+        progress.wait(lock);
+        continue;
+      }
+      lock.unlock();
+      execute(next);
+      lock.lock();
+    }
+
+    if (failure) {
+      std::exception_ptr error = failure;
+      failure = nullptr;
+      std::rethrow_exception(error);
+    }
+
+    commandQueue.flush(world);
+    world.flushObservers();
+    reportOverruns(now);
+  }
+
+  // Deferred structural changes, applied at the end of every run()
+  CommandQueue &commands() { return commandQueue; }
+
+  // Per system, in registration order
+  const std::vector<SystemStats> &stats() const { return systemStats; }
+
+  // When the running system should hand back control: its start plus its
+  // budget, or never if it has none. Only meaningful inside a system.
+  static Clock::time_point deadline() { return currentDeadline; }
+
+  static unsigned defaultWorkerCount() {
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+  }
+
+private:
+  struct SystemEntry {
+    std::string name;
+    std::function<void(ECS2 &)> update;
+    SystemThread thread = SystemThread::Any;
+    Signature reads;
+    Signature writes;
+    std::vector<size_t> dependents;
+    size_t dependencyCount = 0;
+    uint32_t lastRun = 0;
+
+    SystemSchedule schedule;
+    bool due = true;             // Runs this frame
+    Clock::time_point nextRun{}; // Earliest start of the next run
+    uint64_t reportedOverruns = 0;
+    Clock::time_point lastReport{};
+  };
+
+  using Milliseconds = std::chrono::duration<float, std::milli>;
+
+  static constexpr auto REPORT_INTERVAL = std::chrono::seconds(1);
+
+  // Claims the system's next slot if it has come round. After a stall the
+  // schedule restarts from now rather than running to catch up.
+  static bool isDue(SystemEntry &system, Clock::time_point now) {
+    if (system.schedule.rate <= 0.0f)
+      return true;
+    if (now < system.nextRun)
+      return false;
+    auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<float>(1.0f / system.schedule.rate));
+    system.nextRun += period;
+    if (system.nextRun <= now) {
+      system.nextRun = now + period;
+    }
+    return true;
+  }
+
+  // Caller is the thread inside run(), after every system has finished
+  void reportOverruns(Clock::time_point now) {
+    for (size_t i = 0; i < systems.size(); i++) {
+      SystemEntry &system = systems[i];
+      const SystemStats &stats = systemStats[i];
+      uint64_t fresh = stats.overruns - system.reportedOverruns;
+      if (fresh == 0 || now - system.lastReport < REPORT_INTERVAL)
+        continue;
+      Logger::Warn("System \"%s\" over its %.2f ms budget %llu time(s), "
+                   "worst %.2f ms",
+                   system.name.c_str(), system.schedule.budgetMs,
+                   static_cast<unsigned long long>(fresh), stats.worstMs);
+      system.reportedOverruns = stats.overruns;
+      system.lastReport = now;
+    }
+  }
+
+  static bool conflicts(const SystemEntry &a, const SystemEntry &b) {
+    return (a.writes & (b.reads | b.writes)).any() ||
+           (b.writes & a.reads).any();
+  }
+
+  // Edges always point from the earlier registered system to the later one,
+  // so registration order is already a topological order
+  void buildGraph() {
+    for (auto &system : systems) {
+      system.dependents.clear();
+      system.dependencyCount = 0;
+    }
+    for (size_t i = 0; i < systems.size(); i++) {
+      for (size_t j = i + 1; j < systems.size(); j++) {
+        if (conflicts(systems[i], systems[j])) {
+          systems[i].dependents.push_back(j);
+          systems[j].dependencyCount++;
+        }
+      }
+    }
+    pendingDeps.assign(systems.size(), 0);
+    graphDirty = false;
+  }
+
+  // Caller holds mutex
+  void enqueue(size_t system) {
+    if (systems[system].thread == SystemThread::Main) {
+      mainQueue.push_back(system);
+    } else {
+      workerQueue.push_back(system);
+    }
+  }
+
+  void runSystem(size_t index) {
+    SystemEntry &system = systems[index];
+    if (!system.due) {
+      systemStats[index].skips++;
+      return;
+    }
+    Clock::time_point start = Clock::now();
+    SystemTicks previous = currentSystemTicks;
+    currentSystemTicks = {&world, world.advanceTick(), system.lastRun};
+    system.lastRun = currentSystemTicks.thisRun;
+    currentDeadline = Clock::time_point::max();
+    if (system.schedule.budgetMs > 0.0f) {
+      currentDeadline = start + std::chrono::duration_cast<Clock::duration>(
+                                    Milliseconds(system.schedule.budgetMs));
+    }
+    try {
+      CommandQueue::Scope commands(commandQueue, index);
+      system.update(world);
+    } catch (...) {
+      currentSystemTicks = previous;
+      currentDeadline = Clock::time_point::max();
+      throw;
+    }
+    currentSystemTicks = previous;
+    currentDeadline = Clock::time_point::max();
+    record(index, start);
+  }
+
+  void record(size_t index, Clock::time_point start) {
+    const SystemEntry &system = systems[index];
+    SystemStats &stats = systemStats[index];
+    stats.lastMs = Milliseconds(Clock::now() - start).count();
+    stats.averageMs = stats.runs == 0 ? stats.lastMs
+                                      : stats.averageMs * 0.9f +
+                                            stats.lastMs * 0.1f;
+    stats.worstMs = std::max(stats.worstMs, stats.lastMs);
+    stats.runs++;
+    if (system.schedule.budgetMs > 0.0f &&
+        stats.lastMs > system.schedule.budgetMs) {
+      stats.overruns++;
+    }
+  }
+
+  void execute(size_t system) {
+    try {
+      runSystem(system);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!failure) {
+        failure = std::current_exception();
+      }
+    }
+
+    bool newWork = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t dependent : systems[system].dependents) {
+        if (--pendingDeps[dependent] == 0) {
+          enqueue(dependent);
+          newWork = true;
+        }
+      }
+      remaining--;
+    }
+    if (newWork) {
+      workAvailable.notify_all();
+    }
+    progress.notify_all();
+  }
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      workAvailable.wait(lock,
+                         [this] { return stopping || !workerQueue.empty(); });
+      if (stopping)
+        return;
+      size_t next = workerQueue.front();
+      workerQueue.pop_front();
+      lock.unlock();
+      execute(next);
+      lock.lock();
+    }
+  }
+
+  ECS2 &world;
+  CommandQueue commandQueue;
+  std::vector<SystemEntry> systems;
+  std::vector<SystemStats> systemStats; // Parallel to systems
+  bool graphDirty = false;
+  bool firstFrame = true;
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable workAvailable; // Signals workers
+  std::condition_variable progress;      // Signals the thread inside run()
+  std::deque<size_t> mainQueue;
+  std::deque<size_t> workerQueue;
+  std::vector<size_t> pendingDeps;
+  size_t remaining = 0;
+  bool stopping = false;
+  std::exception_ptr failure;
+
+  static inline thread_local Clock::time_point currentDeadline =
+      Clock::time_point::max();
+};
+
+// Cursor for spreading a pass over a range across several runs of a
+// budgeted system. Each step() carries on where the previous one stopped
+// and returns at the system's deadline; once the end is reached the next
+// step() starts over from the beginning. The range may change size between
+// steps, e.g. when it is a query.
+class TimeSlice {
+public:
+  // Calls process(i) for the next indices of [0, count). Returns true when
+  // this call reached the end of the range.
+  template <typename F> bool step(size_t count, F &&process) {
+    Scheduler::Clock::time_point deadline = Scheduler::deadline();
+    if (cursor >= count) {
+      cursor = 0;
+    }
+    while (cursor < count) {
+      process(cursor++);
+      // Work worth slicing costs far more per item than reading the clock
+      if (cursor < count && Scheduler::Clock::now() >= deadline)
+        return false;
+    }
+    return true;
+  }
+
+  size_t position() const { return cursor; }
+
+private:
+  size_t cursor = 0;
+};
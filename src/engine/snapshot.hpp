@@ -0,0 +1,519 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+#include "util/fileUtils.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Binary snapshots of an ECS2 world. Components are registered under a
+// stable name, since ComponentTypeManager ids depend on first-use order and
+// differ between runs. Trivially copyable components are stored as raw
+// columns; string components are stored as indices into one table of
+// interned strings. Components that are not registered are left out.
+//
+// File layout, native byte order, every section 16-byte aligned:
+//   SnapshotHeader
+//   SnapshotComponent[componentCount]
+//   Entity handles[slotCount]      Slot table, NULL_ENTITY for free slots
+//   Entity freeList[freeCount]
+//   SnapshotGroup[groupCount]      Entities sharing one component mask, each
+//                                  with its handles followed by one column
+//                                  per set bit, lowest bit first
+//   uint64_t stringOffsets[stringCount + 1], then the string bytes
+inline constexpr char SNAPSHOT_MAGIC[8] = {'S', 'W', 'S', 'N', 'A', 'P', 0, 0};
+inline constexpr uint32_t SNAPSHOT_VERSION = 2;
+inline constexpr size_t SNAPSHOT_MAX_NAME = 48;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t componentCount;
+  uint32_t slotCount;
+  uint32_t freeCount;
+  uint32_t groupCount;
+  uint32_t stringCount;
+  uint64_t componentsOffset;
+  uint64_t handlesOffset;
+  uint64_t freeListOffset;
+  uint64_t groupsOffset;
+  uint64_t stringsOffset;
+  uint64_t fileSize;
+  uint64_t layout; // WorldSnapshot::layoutHash of the writer
+  uint64_t key;    // Chosen by the writer, checked by load
+};
+
+struct SnapshotComponent {
+  char name[SNAPSHOT_MAX_NAME];
+  uint32_t size; // Bytes per row in the file
+  uint32_t kind; // WorldSnapshot::Kind
+};
+
+struct SnapshotGroup {
+  uint64_t mask; // Bit i set: has the i-th SnapshotComponent
+  uint32_t count;
+  uint32_t reserved;
+  uint64_t offset; // Entity handles, then the columns
+};
+
+class WorldSnapshot {
+public:
+  // Registers a trivially copyable component, stored byte for byte. Tags
+  // take no column space; the group mask alone restores them.
+  template <typename T> void registerComponent(const std::string &name) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "Use registerStringComponent or leave T out of snapshots");
+    Codec codec = makeCodec<T>(name, Kind::Raw, isTag<T> ? 0 : sizeof(T));
+    if constexpr (isTag<T>) {
+      codec.gather = [](ECS2 &, Entity, std::byte *, Interner &) {};
+      codec.scatter = [](ECS2 &, Entity, const std::byte *, const Strings &,
+                         uint32_t) {};
+    } else {
+      codec.gather = [](ECS2 &world, Entity e, std::byte *out, Interner &) {
+        std::memcpy(out, &world.getComponent<const T>(e), sizeof(T));
+      };
+      if constexpr (!isArchetypeStored<T>) {
+        codec.scatter = [](ECS2 &world, Entity e, const std::byte *in,
+                           const Strings &, uint32_t tick) {
+          T component;
+          std::memcpy(&component, in, sizeof(T));
+          world.getStore<T>().add(e, std::move(component), tick);
+        };
+      }
+    }
+    codecs.push_back(std::move(codec));
+  }
+
+  // Registers a component whose state is one std::string member, e.g.
+  // registerStringComponent(&Name::value, "Name"). Equal strings are
+  // written once.
+  template <typename T>
+  void registerStringComponent(std::string T::*member,
+                               const std::string &name) {
+    static_assert(!isArchetypeStored<T>,
+                  "String components are restored through their store");
+    Codec codec = makeCodec<T>(name, Kind::String, sizeof(uint32_t));
+    codec.gather = [member](ECS2 &world, Entity e, std::byte *out,
+                            Interner &strings) {
+      uint32_t index = strings.intern(world.getComponent<const T>(e).*member);
+      std::memcpy(out, &index, sizeof(index));
+    };
+    codec.scatter = [member](ECS2 &world, Entity e, const std::byte *in,
+                             const Strings &strings, uint32_t tick) {
+      uint32_t index;
+      std::memcpy(&index, in, sizeof(index));
+      T component{};
+      component.*member = std::string(strings.get(index));
+      world.getStore<T>().add(e, std::move(component), tick);
+    };
+    codecs.push_back(std::move(codec));
+  }
+
+  // Writes every live entity and its registered components to path. Must be
+  // called at a sync point, not while systems are running. key is stored
+  // as-is, e.g. a hash of whatever the world was built from.
+  void save(ECS2 &world, const std::string &path, uint64_t key = 0) const {
+    std::vector<std::byte> file = serialize(world, key);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out.write(reinterpret_cast<const char *>(file.data()),
+                   static_cast<std::streamsize>(file.size()))) {
+      throw std::runtime_error("Failed to write snapshot: " + path);
+    }
+  }
+
+  // Maps path and restores it into world, which must not have created any
+  // entities yet. Entity handles are restored exactly, generations included.
+  // If this throws part way through, discard the world. A file saved with
+  // another key or component layout is out of date and is rejected before
+  // the world is touched.
+  void load(ECS2 &world, const std::string &path, uint64_t key = 0) const {
+    MappedFile file(path.c_str());
+    if (!file) {
+      throw std::runtime_error("Failed to map snapshot: " + path);
+    }
+    restore(world, file.data(), file.size(), key);
+  }
+
+  std::vector<std::byte> serialize(ECS2 &world, uint64_t key = 0) const;
+  void restore(ECS2 &world, const std::byte *data, size_t size,
+               uint64_t key = 0) const;
+
+  // Hash of the file version and each registered component's name, kind and
+  // size, in registration order
+  uint64_t layoutHash() const {
+    uint64_t hash = hashBytes(&SNAPSHOT_VERSION, sizeof(SNAPSHOT_VERSION));
+    for (const Codec &codec : codecs) {
+      hash = hashBytes(codec.name.data(), codec.name.size() + 1, hash);
+      hash = hashBytes(&codec.kind, sizeof(codec.kind), hash);
+      hash = hashBytes(&codec.size, sizeof(codec.size), hash);
+    }
+    return hash;
+  }
+
+private:
+  enum class Kind : uint32_t { Raw = 0, String = 1 };
+
+  class Interner {
+  public:
+    uint32_t intern(const std::string &value) {
+      auto [it, inserted] =
+          indices.try_emplace(value, static_cast<uint32_t>(values.size()));
+      if (inserted) {
+        values.push_back(&it->first);
+      }
+      return it->second;
+    }
+
+    const std::vector<const std::string *> &getValues() const {
+      return values;
+    }
+
+  private:
+    std::unordered_map<std::string, uint32_t> indices;
+    std::vector<const std::string *> values; // In index order
+  };
+
+  // The string table of a mapped snapshot
+  class Strings {
+  public:
+    Strings(const uint64_t *offsets, const char *bytes, uint32_t count)
+        : offsets(offsets), bytes(bytes), count(count) {}
+
+    std::string_view get(uint32_t index) const {
+      if (index >= count) {
+        throw std::runtime_error("Snapshot string index out of range!");
+      }
+      return std::string_view(bytes + offsets[index],
+                              offsets[index + 1] - offsets[index]);
+    }
+
+  private:
+    const uint64_t *offsets;
+    const char *bytes;
+    uint32_t count;
+  };
+
+  struct Codec {
+    std::string name;
+    Kind kind;
+    uint32_t size;
+    uint8_t componentId;
+    bool archetype;
+    std::function<void(ECS2 &, Entity, std::byte *, Interner &)> gather;
+    // Unset for raw archetype components, which are copied into chunks
+    std::function<void(ECS2 &, Entity, const std::byte *, const Strings &,
+                       uint32_t)>
+        scatter;
+  };
+
+  template <typename T>
+  Codec makeCodec(const std::string &name, Kind kind, uint32_t size) const {
+    if (name.empty() || name.size() >= SNAPSHOT_MAX_NAME) {
+      throw std::runtime_error("Invalid snapshot component name: " + name);
+    }
+    if (codecs.size() >= 64) {
+      throw std::runtime_error("Too many snapshot components!");
+    }
+    Codec codec;
+    codec.name = name;
+    codec.kind = kind;
+    codec.size = size;
+    codec.componentId = ComponentTypeManager::getId<T>();
+    codec.archetype = isArchetypeStored<T>;
+    return codec;
+  }
+
+  static size_t align16(size_t offset) { return (offset + 15) & ~size_t(15); }
+
+  std::vector<Codec> codecs;
+};
+
+inline std::vector<std::byte> WorldSnapshot::serialize(ECS2 &world,
+                                                      uint64_t key) const {
+  // Group live entities by which registered components they have, in order
+  // of first appearance so the output is deterministic
+  std::vector<uint64_t> masks;
+  std::vector<std::vector<Entity>> members;
+  std::unordered_map<uint64_t, size_t> groupOf;
+  for (uint32_t index = 1; index < world.handles.size(); index++) {
+    Entity e = world.handles[index];
+    if (e == NULL_ENTITY)
+      continue;
+    uint64_t mask = 0;
+    for (size_t c = 0; c < codecs.size(); c++) {
+      if (world.signatures[index].test(codecs[c].componentId)) {
+        mask |= uint64_t(1) << c;
+      }
+    }
+    auto [it, inserted] = groupOf.try_emplace(mask, masks.size());
+    if (inserted) {
+      masks.push_back(mask);
+      members.emplace_back();
+    }
+    members[it->second].push_back(e);
+  }
+
+  SnapshotHeader header{};
+  std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  header.version = SNAPSHOT_VERSION;
+  header.componentCount = static_cast<uint32_t>(codecs.size());
+  header.slotCount = static_cast<uint32_t>(world.handles.size());
+  header.freeCount = static_cast<uint32_t>(world.freeList.size());
+  header.groupCount = static_cast<uint32_t>(masks.size());
+  header.layout = layoutHash();
+  header.key = key;
+
+  size_t offset = align16(sizeof(SnapshotHeader));
+  header.componentsOffset = offset;
+  offset = align16(offset + codecs.size() * sizeof(SnapshotComponent));
+  header.handlesOffset = offset;
+  offset = align16(offset + world.handles.size() * sizeof(Entity));
+  header.freeListOffset = offset;
+  offset = align16(offset + world.freeList.size() * sizeof(Entity));
+  header.groupsOffset = offset;
+  offset = align16(offset + masks.size() * sizeof(SnapshotGroup));
+
+  std::vector<SnapshotGroup> groups(masks.size());
+  for (size_t g = 0; g < masks.size(); g++) {
+    groups[g] = {masks[g], static_cast<uint32_t>(members[g].size()), 0,
+                 offset};
+    offset = align16(offset + members[g].size() * sizeof(Entity));
+    for (size_t c = 0; c < codecs.size(); c++) {
+      if (masks[g] & (uint64_t(1) << c)) {
+        offset = align16(offset + members[g].size() * codecs[c].size);
+      }
+    }
+  }
+
+  std::vector<std::byte> file(offset);
+  Interner strings;
+  for (size_t g = 0; g < groups.size(); g++) {
+    size_t at = groups[g].offset;
+    std::memcpy(file.data() + at, members[g].data(),
+                members[g].size() * sizeof(Entity));
+    at = align16(at + members[g].size() * sizeof(Entity));
+    for (size_t c = 0; c < codecs.size(); c++) {
+      if (!(masks[g] & (uint64_t(1) << c)))
+        continue;
+      for (Entity e : members[g]) {
+        codecs[c].gather(world, e, file.data() + at, strings);
+        at += codecs[c].size;
+      }
+      at = align16(at);
+    }
+  }
+
+  // The string table goes last since its size is only known now
+  const auto &values = strings.getValues();
+  header.stringCount = static_cast<uint32_t>(values.size());
+  header.stringsOffset = file.size();
+  std::vector<uint64_t> stringOffsets(values.size() + 1, 0);
+  for (size_t i = 0; i < values.size(); i++) {
+    stringOffsets[i + 1] = stringOffsets[i] + values[i]->size();
+  }
+  size_t tableBytes = stringOffsets.size() * sizeof(uint64_t);
+  file.resize(align16(file.size() + tableBytes + stringOffsets.back()));
+  std::memcpy(file.data() + header.stringsOffset, stringOffsets.data(),
+              tableBytes);
+  std::byte *chars = file.data() + header.stringsOffset + tableBytes;
+  for (size_t i = 0; i < values.size(); i++) {
+    std::memcpy(chars + stringOffsets[i], values[i]->data(),
+                values[i]->size());
+  }
+  header.fileSize = file.size();
+
+  std::memcpy(file.data(), &header, sizeof(header));
+  for (size_t c = 0; c < codecs.size(); c++) {
+    SnapshotComponent record{};
+    std::memcpy(record.name, codecs[c].name.data(), codecs[c].name.size());
+    record.size = codecs[c].size;
+    record.kind = static_cast<uint32_t>(codecs[c].kind);
+    std::memcpy(file.data() + header.componentsOffset +
+                    c * sizeof(SnapshotComponent),
+                &record, sizeof(record));
+  }
+  std::memcpy(file.data() + header.handlesOffset, world.handles.data(),
+              world.handles.size() * sizeof(Entity));
+  // An empty vector's data() may be null, which memcpy must not be given
+  if (!world.freeList.empty()) {
+    std::memcpy(file.data() + header.freeListOffset, world.freeList.data(),
+                world.freeList.size() * sizeof(Entity));
+  }
+  if (!groups.empty()) {
+    std::memcpy(file.data() + header.groupsOffset, groups.data(),
+                groups.size() * sizeof(SnapshotGroup));
+  }
+  return file;
+}
+
+inline void WorldSnapshot::restore(ECS2 &world, const std::byte *data,
+                                   size_t size, uint64_t key) const {
+  auto fits = [size](uint64_t offset, uint64_t bytes) {
+    return offset <= size && bytes <= size - offset;
+  };
+
+  SnapshotHeader header;
+  if (size < sizeof(header)) {
+    throw std::runtime_error("Snapshot is truncated!");
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+    throw std::runtime_error("Not a world snapshot!");
+  }
+  if (header.version != SNAPSHOT_VERSION) {
+    throw std::runtime_error("Unsupported snapshot version!");
+  }
+  if (header.layout != layoutHash() || header.key != key) {
+    throw std::runtime_error("Snapshot is out of date!");
+  }
+  if (header.fileSize != size || header.slotCount == 0 ||
+      header.slotCount > ENTITY_INDEX_MASK + 1 || header.componentCount > 64 ||
+      !fits(header.componentsOffset,
+            uint64_t(header.componentCount) * sizeof(SnapshotComponent)) ||
+      !fits(header.handlesOffset,
+            uint64_t(header.slotCount) * sizeof(Entity)) ||
+      !fits(header.freeListOffset,
+            uint64_t(header.freeCount) * sizeof(Entity)) ||
+      !fits(header.groupsOffset,
+            uint64_t(header.groupCount) * sizeof(SnapshotGroup)) ||
+      !fits(header.stringsOffset,
+            (uint64_t(header.stringCount) + 1) * sizeof(uint64_t))) {
+    throw std::runtime_error("Snapshot is corrupt!");
+  }
+  if (world.nextIndex != 1) {
+    throw std::runtime_error("Snapshots can only be loaded into a new world!");
+  }
+
+  // Match the file's components to registered codecs by name
+  std::vector<const Codec *> fileCodecs(header.componentCount, nullptr);
+  for (uint32_t c = 0; c < header.componentCount; c++) {
+    SnapshotComponent record;
+    std::memcpy(&record,
+                data + header.componentsOffset + c * sizeof(SnapshotComponent),
+                sizeof(record));
+    record.name[SNAPSHOT_MAX_NAME - 1] = '\0';
+    for (const Codec &codec : codecs) {
+      if (codec.name == record.name) {
+        if (codec.size != record.size ||
+            static_cast<uint32_t>(codec.kind) != record.kind) {
+          throw std::runtime_error("Snapshot component layout changed: " +
+                                   codec.name);
+        }
+        fileCodecs[c] = &codec;
+      }
+    }
+  }
+
+  const uint64_t *stringOffsets =
+      reinterpret_cast<const uint64_t *>(data + header.stringsOffset);
+  const char *stringBytes = reinterpret_cast<const char *>(
+      data + header.stringsOffset +
+      (uint64_t(header.stringCount) + 1) * sizeof(uint64_t));
+  for (uint32_t i = 0; i < header.stringCount; i++) {
+    if (stringOffsets[i] > stringOffsets[i + 1]) {
+      throw std::runtime_error("Snapshot is corrupt!");
+    }
+  }
+  if (!fits(static_cast<uint64_t>(
+                reinterpret_cast<const std::byte *>(stringBytes) - data),
+            stringOffsets[header.stringCount])) {
+    throw std::runtime_error("Snapshot is corrupt!");
+  }
+  Strings strings(stringOffsets, stringBytes, header.stringCount);
+
+  // Slot tables come straight from the file
+  world.nextIndex = header.slotCount;
+  world.handles.resize(header.slotCount);
+  std::memcpy(world.handles.data(), data + header.handlesOffset,
+              header.slotCount * sizeof(Entity));
+  world.freeList.assign(
+      reinterpret_cast<const Entity *>(data + header.freeListOffset),
+      reinterpret_cast<const Entity *>(data + header.freeListOffset) +
+          header.freeCount);
+  world.signatures.assign(header.slotCount, Signature(0));
+  world.locations.assign(header.slotCount, ECS2::EntityLocation{});
+
+  uint32_t tick = world.writeTick();
+  for (uint32_t g = 0; g < header.groupCount; g++) {
+    SnapshotGroup group;
+    std::memcpy(&group, data + header.groupsOffset + g * sizeof(SnapshotGroup),
+                sizeof(group));
+    // A full 64-component mask has no spare bits, and shifting by 64 is
+    // undefined
+    if ((header.componentCount < 64 &&
+         group.mask >> header.componentCount != 0) ||
+        !fits(group.offset, uint64_t(group.count) * sizeof(Entity))) {
+      throw std::runtime_error("Snapshot is corrupt!");
+    }
+
+    const std::byte *entities = data + group.offset;
+    Signature signature;
+    Signature archetypeSignature;
+    for (uint32_t c = 0; c < header.componentCount; c++) {
+      if ((group.mask >> c & 1) && fileCodecs[c]) {
+        signature.set(fileCodecs[c]->componentId);
+        if (fileCodecs[c]->archetype) {
+          archetypeSignature.set(fileCodecs[c]->componentId);
+        }
+      }
+    }
+    Archetype *archetype = archetypeSignature.any()
+                               ? world.getArchetype(archetypeSignature)
+                               : nullptr;
+
+    for (uint32_t i = 0; i < group.count; i++) {
+      Entity e;
+      std::memcpy(&e, entities + i * sizeof(Entity), sizeof(Entity));
+      uint32_t index = entityIndex(e);
+      if (index == 0 || index >= header.slotCount ||
+          world.handles[index] != e) {
+        throw std::runtime_error("Snapshot is corrupt!");
+      }
+      world.signatures[index] = signature;
+      world.recordObserved(e, signature, false);
+      if (archetype) {
+        world.locations[index] = {archetype, archetype->allocateRow(e)};
+      }
+    }
+
+    // Columns follow the handles; archetype rows were allocated in group
+    // order, so raw archetype columns are plain copies into the chunks
+    size_t at = align16(group.offset + group.count * sizeof(Entity));
+    for (uint32_t c = 0; c < header.componentCount; c++) {
+      if (!(group.mask >> c & 1))
+        continue;
+      SnapshotComponent record;
+      std::memcpy(&record,
+                  data + header.componentsOffset +
+                      c * sizeof(SnapshotComponent),
+                  sizeof(record));
+      if (!fits(at, uint64_t(group.count) * record.size)) {
+        throw std::runtime_error("Snapshot is corrupt!");
+      }
+      const Codec *codec = fileCodecs[c];
+      for (uint32_t i = 0; codec && i < group.count; i++) {
+        const std::byte *in = data + at + size_t(i) * record.size;
+        Entity e;
+        std::memcpy(&e, entities + i * sizeof(Entity), sizeof(Entity));
+        if (codec->scatter) {
+          codec->scatter(world, e, in, strings, tick);
+        } else {
+          const auto &loc = world.locations[entityIndex(e)];
+          std::memcpy(loc.archetype->slotFor(codec->componentId, loc.row), in,
+                      record.size);
+          loc.archetype->ticksFor(codec->componentId, loc.row) = {tick, tick};
+        }
+      }
+      at = align16(at + size_t(group.count) * record.size);
+    }
+  }
+
+  world.populateQueries();
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+#include <cstdint>
+
+// Position in WorldLoader::entityBlueprints of the blueprint an entity was
+// spawned from, so a scene restored from its cache can resolve the
+// blueprint's assets again
+struct BlueprintIndex {
+  uint32_t value = 0;
+};
+
+template <> struct ComponentStorage<BlueprintIndex> : SparseSetStorage {};
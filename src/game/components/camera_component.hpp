@@ -1,5 +1,6 @@
 // game/components/camera_component.h
 #pragma once
+#include "engine/ecs2.hpp"
 #include <glm/glm.hpp>
 
 struct CameraComponent {
@@ -18,3 +19,5 @@ struct CameraComponent {
 
   bool constrainPitch = true;
 };
+
+template <> struct ComponentStorage<CameraComponent> : SparseSetStorage {};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+
+// Attaches an entity to another one; its Transform is then relative to the
+// parent's world transform. Use setParent/clearParent from
+// game/utils/hierarchyUtils.hpp so Children stays in sync.
+struct Parent {
+  Entity entity = NULL_ENTITY;
+};
+
+struct Children {
+  std::vector<Entity> entities;
+};
+
+// Local-to-world matrix, written by TransformSystem
+struct WorldTransform {
+  glm::mat4 matrix = glm::mat4(1.0f);
+};
+
+template <> struct ComponentStorage<Parent> : SparseSetStorage {};
+template <> struct ComponentStorage<Children> : SparseSetStorage {};
+template <> struct ComponentStorage<WorldTransform> : ArchetypeStorage {};
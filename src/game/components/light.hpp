@@ -1,5 +1,6 @@
 #pragma once
 
+#include "engine/ecs2.hpp"
 #include <glm/glm.hpp>
 
 using namespace glm;
@@ -11,8 +12,12 @@ struct LightComponent {
   int type = 0; // 0: Directional, 1: Point, 2: Spot
 };
 
+template <> struct ComponentStorage<LightComponent> : ArchetypeStorage {};
+
 // Only added to entities that need it
 struct SpotLightComponent {
   float innerAngle = 0.9f; // Pre-calculated cos(angle)
   float outerAngle = 0.8f;
 };
+
+template <> struct ComponentStorage<SpotLightComponent> : SparseSetStorage {};
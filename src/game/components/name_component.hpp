@@ -1,7 +1,10 @@
 #pragma once
 
+#include "engine/ecs2.hpp"
 #include <string>
 
 struct Name {
   std::string value;
 };
+
+template <> struct ComponentStorage<Name> : SparseSetStorage {};
@@ -1,4 +1,6 @@
 #pragma once
+#include "engine/ecs2.hpp"
+#include "platform/rendering/bounds.hpp"
 #include "platform/rendering/shader.hpp"
 #include "platform/rendering/texture.hpp"
 #include <vector>
@@ -10,6 +12,15 @@ struct Renderable {
   bool depthTesting = true;
   std::vector<Texture *> textures;
   Shader *shader = nullptr;
+  // Where the mesh sits in the shared buffers behind vao
+  int baseVertex = 0;
+  unsigned int firstIndex = 0;
+  // The mesh's local bounds, for culling. Left empty, the entity is drawn
+  // only while its origin is in view.
+  Bounds bounds;
 };
 
 struct Color : glm::vec3 {};
+
+template <> struct ComponentStorage<Renderable> : ArchetypeStorage {};
+template <> struct ComponentStorage<Color> : ArchetypeStorage {};
@@ -1,4 +1,5 @@
 #pragma once
+#include "engine/ecs2.hpp"
 #include <glm/glm.hpp>
 
 struct Transform {
@@ -6,3 +7,5 @@ struct Transform {
   glm::vec3 rotation = glm::vec3(0.0f, 0.0f, 0.0f);
   glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f); // Default must be 1.0
 };
+
+template <> struct ComponentStorage<Transform> : ArchetypeStorage {};
@@ -1,7 +1,10 @@
 #include "game/game.hpp"
 #include "assets/assetManager.hpp"
 #include "engine/ecs2.hpp"
+#include "engine/snapshot.hpp"
+#include "game/components/blueprint_component.hpp"
 #include "game/components/camera_component.hpp"
+#include "game/components/hierarchy.hpp"
 #include "game/components/light.hpp"
 #include "game/components/name_component.hpp"
 #include "game/components/renderable.hpp"
@@ -9,6 +12,8 @@
 #include "game/systems/camera_system.hpp"
 #include "game/systems/lightingSystem.hpp"
 #include "game/systems/render_system.hpp"
+#include "game/systems/transform_system.hpp"
+#include "game/utils/hierarchyUtils.hpp"
 #include "game/utils/worldLoader.hpp"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -16,21 +21,30 @@
 #include "platform/gui/guiHandler.hpp"
 #include "platform/input/inputHandler.hpp"
 #include "platform/rendering/uniform_buffer_management.hpp"
+#include "util/fileUtils.hpp"
 #include "util/logger.hpp"
 #include "util/stringUtils.hpp"
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/ext/quaternion_geometric.hpp>
 #include <glm/geometric.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <math/raycast.hpp>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 Game::Game(int width, int height, const std::string &title)
     : window(width, height, title), inputHandler(false, false),
       uniformBufferManager(256, 0), guiHandler(window.getGLFWwindow()),
 
-      cameraSystem(&camera), lightingSystem(1), totalTime(0.0) {}
+      cameraSystem(&camera), lightingSystem(1), scheduler(world),
+      totalTime(0.0) {}
 
 void Game::run() {
   setupScene();
@@ -42,6 +56,7 @@ void Game::run() {
 
   while (!window.shouldClose()) {
     window.tickFrame();
+    frameArena.reset();
 
     float dt = (*window.getDelta());
     float tt = (*window.getTime());
@@ -51,8 +66,8 @@ void Game::run() {
     inputHandler.updateKeyboard();
     inputHandler.updateMouseButton();
 
-    cameraSystem.update(world);
-    lightingSystem.Update(world);
+    scheduler.run();
+    compactor.step(world, std::chrono::microseconds(500));
 
     glm::mat4 cameraProjectionMatrix = camera.getProjectionMatrix();
     glm::mat4 cameraViewMatrix = camera.getViewMatrix();
@@ -75,6 +90,14 @@ void Game::run() {
     ImGui::Text("ROTAT: x%.2f y%.2f z%.2f", camera.front.x, camera.front.y,
                 camera.front.z);
     ImGui::Text("Zoom: %.2f", camera.zoom);
+    ImGui::Text("Culled: %zu", renderSystem.culled());
+    ImGui::SeparatorText("Systems");
+    for (const SystemStats &stats : scheduler.stats()) {
+      ImGui::Text("%-10s %6.3f ms (worst %6.3f) skip %llu over %llu",
+                  stats.name.c_str(), stats.averageMs, stats.worstMs,
+                  static_cast<unsigned long long>(stats.skips),
+                  static_cast<unsigned long long>(stats.overruns));
+    }
     ImGui::SeparatorText("Logs");
     if (ImGui::Button("Clear Logs")) {
       Logger::Clear();
@@ -95,7 +118,7 @@ void Game::run() {
     ImGui::End();
 
     guiHandler.Finalize();
-    renderSystem.update(world);
+    renderSystem.update(world, frameArena, camera);
     guiHandler.Render();
 
     window.swapBuffers();
@@ -111,7 +134,19 @@ void Game::setupScene() {
   window.setMouseButtonCallback(mouseButtonCallback);
   window.setScrollCallback(scrollCallback);
 
-  renderSystem = RenderSystem();
+  lightingSystem.observe(world);
+
+  // The lighting UBO upload needs the GL context, so it stays on this thread.
+  // Lights change rarely, so ten updates a second are plenty.
+  scheduler.addSystem("camera", Reads<>(), Writes<CameraComponent>(),
+                      [this](ECS2 &ecs) { cameraSystem.update(ecs); });
+  scheduler.addSystem("transform", Reads<Transform, Parent, Children>(),
+                      Writes<WorldTransform>(),
+                      [this](ECS2 &ecs) { transformSystem.update(ecs); });
+  scheduler.addSystem(
+      "lighting", Reads<WorldTransform, LightComponent, SpotLightComponent>(),
+      Writes<>(), [this](ECS2 &ecs) { lightingSystem.Update(ecs); },
+      SystemThread::Main, SystemSchedule{10.0f, 1.0f});
 
   inputHandler.setMouseSensitiviy(0.5);
 
@@ -120,89 +155,251 @@ void Game::setupScene() {
                                        16);
   uniformBufferManager.registerUniform("uDeltatime", sizeof(float), 4);
   uniformBufferManager.registerUniform("uTime", sizeof(float), 4);
+
+  // Instanced draws are culled on the GPU where compute shaders and
+  // multi-draw indirect are available, on the CPU elsewhere
+  if (gl4::computeShaders && gl4::multiDrawIndirect) {
+    renderSystem.setCullShader(&AssetManager::loadComputeShader(
+        "cull", "assets/shaders/cull.comp"));
+  }
+}
+
+// Resolves the mesh and shader of a blueprint that has a MESH entry
+static Renderable makeRenderable(const EntityBlueprint &i) {
+  Mesh m = AssetManager::getMesh(i.data.at("MESH").c_str());
+  return Renderable{m.VAO,
+                    m.indexCount,
+                    m.suggestedDrawMode,
+                    true,
+                    m.textures,
+                    i.data.count("SHADER")
+                        ? &AssetManager::getShader(i.data.at("SHADER").c_str())
+                        : &AssetManager::getShader("default"),
+                    m.baseVertex,
+                    m.firstIndex,
+                    m.bounds};
+}
+
+// Parses a blueprint and resolves its assets once; the resulting prefab can
+// then be spawned any number of times without touching strings again
+static Prefab compileBlueprint(const EntityBlueprint &i) {
+  Prefab prefab;
+  prefab.set(Name{i.name});
+  if (i.data.count("POS")) {
+    Transform t{glm::vec3(0), glm::vec3(0), glm::vec3(1)};
+    t.position = parseVec<glm::vec3>(i.data.at("POS"));
+    if (i.data.count("ROT")) {
+      t.rotation = parseVec<glm::vec3>(i.data.at("ROT"));
+    }
+    if (i.data.count("SCALE")) {
+      t.scale = parseVec<glm::vec3>(i.data.at("SCALE"));
+    }
+
+    prefab.set(t);
+    prefab.set(WorldTransform{});
+  }
+  if (i.data.count("MESH")) {
+    prefab.set(makeRenderable(i));
+  }
+  if (i.data.count("COLOR")) {
+    Color c(parseVec<glm::vec3>(i.data.at("COLOR")));
+    prefab.set(c);
+  }
+  if (i.data.count("LIGHT")) {
+    std::string ld = i.data.at("LIGHT");
+    size_t delim = ld.find(',');
+    std::string key = ld.substr(0, delim);
+    std::string value = ld.substr(delim + 1);
+    auto params = stringUtils::split(value, ',');
+
+    LightComponent light;
+    std::string typeStr = stringUtils::trim(params[0]);
+
+    if (typeStr == "DIRECTIONAL")
+      light.type = 0;
+    else if (typeStr == "POINT")
+      light.type = 1;
+    else if (typeStr == "SPOT")
+      light.type = 2;
+
+    light.color = {std::stof(params[1]), std::stof(params[2]),
+                   std::stof(params[3])};
+    light.intensity = std::stof(params[4]);
+    light.range = std::stof(params[5]);
+
+    prefab.set(light);
+
+    if (light.type == 2 && params.size() > 6) {
+      SpotLightComponent spot;
+      spot.outerAngle = std::stof(params[6]);
+      prefab.set(spot);
+    }
+  }
+  return prefab;
+}
+
+// What the scene cache keeps. Renderable holds GL handles and Children is
+// rebuilt from Parent, so neither is stored.
+static WorldSnapshot sceneSnapshot() {
+  WorldSnapshot snapshot;
+  snapshot.registerStringComponent(&Name::value, "Name");
+  snapshot.registerComponent<BlueprintIndex>("BlueprintIndex");
+  snapshot.registerComponent<Transform>("Transform");
+  snapshot.registerComponent<WorldTransform>("WorldTransform");
+  snapshot.registerComponent<Color>("Color");
+  snapshot.registerComponent<LightComponent>("Light");
+  snapshot.registerComponent<SpotLightComponent>("SpotLight");
+  snapshot.registerComponent<Parent>("Parent");
+  return snapshot;
+}
+
+// Hash of the world file and every file it references, so editing any of
+// them makes the cache out of date
+static uint64_t sceneCacheKey(const std::string &worldPath,
+                              const WorldLoader &l) {
+  uint64_t key = hashFile(worldPath.c_str());
+  auto add = [&](const std::string &path) {
+    std::string trimmed = stringUtils::trim(path);
+    key = hashBytes(trimmed.data(), trimmed.size() + 1, key);
+    key = hashFile(trimmed.c_str(), key);
+  };
+  for (const auto &[name, paths] : l.shaderObjects.all()) {
+    for (const std::string &path : paths)
+      add(path);
+  }
+  for (const auto &[name, path] : l.instancedShaderObjects.all())
+    add(path);
+  for (const auto &[name, path] : l.meshObjects.all())
+    add(path);
+  for (const auto &[name, path] : l.textureObjects.all())
+    add(path);
+  return key;
+}
+
+// One cache file per world file, named after it and a hash of its full path.
+// Empty if there is no user cache directory.
+static std::filesystem::path sceneCachePath(const std::string &worldPath) {
+  std::filesystem::path dir = userCacheDir();
+  if (dir.empty())
+    return {};
+  std::string full = std::filesystem::absolute(worldPath).string();
+  char suffix[24];
+  std::snprintf(suffix, sizeof(suffix), "-%016llx.snap",
+                static_cast<unsigned long long>(
+                    hashBytes(full.data(), full.size())));
+  return dir / "scenes" /
+         (std::filesystem::path(worldPath).stem().string() + suffix);
 }
 
 void Game::loadScene(std::string fp = "assets/worlds/test.swld") {
   WorldLoader l(fp);
-  for (auto [i, x] : l.shaderObjects.all()) {
+  for (const auto &[i, x] : l.shaderObjects.all()) {
     Logger::Debug("Loading shader %s", i.c_str());
     AssetManager::loadShader(i, x[0], x[1]);
+    if (l.instancedShaderObjects.contains(i)) {
+      AssetManager::loadInstancedShader(i, l.instancedShaderObjects[i], x[1]);
+    }
   }
-  for (auto [i, x] : l.meshObjects.all()) {
+  for (const auto &[i, x] : l.meshObjects.all()) {
     AssetManager::loadMesh(i, x.c_str());
   }
-  for (auto i : l.entityBlueprints) {
-    Entity e = world.createEntity();
-    Name n{i.name};
-    world.addComponent(e, n);
-    if (i.data.count("POS")) {
-      Transform t{glm::vec3(0), glm::vec3(0), glm::vec3(1)};
-      t.position = parseVec<glm::vec3>(i.data.at("POS"));
-      if (i.data.count("ROT")) {
-        t.rotation = parseVec<glm::vec3>(i.data.at("ROT"));
-      }
-      if (i.data.count("SCALE")) {
-        t.scale = parseVec<glm::vec3>(i.data.at("SCALE"));
-      }
-
-      world.addComponent(e, t);
+  // The scene is built in a staging world and moved over in one go, so the
+  // live world only sees complete entities with their hierarchy resolved.
+  // The staging world is cached per user; a failed load leaves it half
+  // restored, so it lives on the heap to be replaced.
+  WorldSnapshot snapshot = sceneSnapshot();
+  std::filesystem::path cachePath = sceneCachePath(fp);
+  uint64_t key = sceneCacheKey(fp, l);
+  auto staging = std::make_unique<ECS2>();
+  std::vector<Entity> spawned;
+  bool cached = false;
+  std::error_code error;
+  if (!cachePath.empty() && std::filesystem::exists(cachePath, error)) {
+    try {
+      snapshot.load(*staging, cachePath.string(), key);
+      spawned = restoreScene(*staging, l);
+      cached = true;
+    } catch (const std::exception &e) {
+      Logger::Info("Rebuilding scene cache %s: %s", cachePath.c_str(),
+                   e.what());
+      staging = std::make_unique<ECS2>();
+      spawned.clear();
     }
-    if (i.data.count("MESH")) {
-      Mesh m = AssetManager::getMesh(i.data.at("MESH").c_str());
-
-      Renderable r =
-          Renderable{m.VAO,
-                     m.indexCount,
-                     m.suggestedDrawMode,
-                     true,
-                     m.textures,
-                     i.data.count("SHADER")
-                         ? &AssetManager::getShader(i.data.at("SHADER").c_str())
-                         : &AssetManager::getShader("default")};
-
-      world.addComponent(e, r);
-    }
-    if (i.data.count("COLOR")) {
-      Color c(parseVec<glm::vec3>(i.data.at("COLOR")));
-      world.addComponent(e, c);
-    }
-    if (i.data.count("LIGHT")) {
-      std::string ld = i.data.at("LIGHT");
-      size_t delim = ld.find(',');
-      std::string key = ld.substr(0, delim);
-      std::string value = ld.substr(delim + 1);
-      auto params = stringUtils::split(value, ',');
-
-      LightComponent light;
-      std::string typeStr = stringUtils::trim(params[0]);
-
-      if (typeStr == "DIRECTIONAL")
-        light.type = 0;
-      else if (typeStr == "POINT")
-        light.type = 1;
-      else if (typeStr == "SPOT")
-        light.type = 2;
-
-      light.color = {std::stof(params[1]), std::stof(params[2]),
-                     std::stof(params[3])};
-      light.intensity = std::stof(params[4]);
-      light.range = std::stof(params[5]);
-
-      world.addComponent(e, light);
-
-      if (light.type == 2 && params.size() > 6) {
-        SpotLightComponent spot;
-        spot.outerAngle = std::stof(params[6]);
-        world.addComponent(e, spot);
+  }
+  if (!cached) {
+    spawned = buildScene(*staging, l);
+    if (!cachePath.empty()) {
+      try {
+        std::filesystem::create_directories(cachePath.parent_path());
+        snapshot.save(*staging, cachePath.string(), key);
+      } catch (const std::exception &e) {
+        Logger::Warn("Could not write scene cache: %s", e.what());
       }
     }
   }
+  std::vector<Entity> moved = ECS2::migrate(spawned, *staging, world);
+  remapHierarchy(world, spawned, moved);
 
   Entity ce = world.createEntity();
   CameraComponent cc = CameraComponent();
   world.addComponent(ce, cc);
 }
 
+std::vector<Entity> Game::buildScene(ECS2 &staging, const WorldLoader &l) {
+  std::vector<Entity> spawned;
+  std::unordered_map<std::string, Entity> named;
+  std::vector<std::pair<Entity, std::string>> parents;
+  for (uint32_t b = 0; b < l.entityBlueprints.size(); b++) {
+    const EntityBlueprint &i = l.entityBlueprints[b];
+    std::string name = stringUtils::trim(i.name);
+    Prefab prefab = compileBlueprint(i);
+    prefab.set(BlueprintIndex{b});
+    auto [it, inserted] = prefabs.insert_or_assign(name, std::move(prefab));
+    Entity e = staging.spawnBatch(it->second, 1)[0];
+    spawned.push_back(e);
+    named[name] = e;
+    if (i.data.count("PARENT")) {
+      parents.push_back({e, stringUtils::trim(i.data.at("PARENT"))});
+    }
+  }
+
+  // Parents may be declared after their children, so attach them last
+  for (auto &[child, parentName] : parents) {
+    auto it = named.find(parentName);
+    if (it == named.end()) {
+      Logger::Error("Unknown parent \"%s\"", parentName.c_str());
+    } else if (!setParent(staging, child, it->second)) {
+      Logger::Error("Parenting to \"%s\" would create a cycle",
+                    parentName.c_str());
+    }
+  }
+  return spawned;
+}
+
+std::vector<Entity> Game::restoreScene(ECS2 &staging, const WorldLoader &l) {
+  // The cache key covers the world file, so blueprint indices still match
+  std::vector<Entity> spawned = staging.query<BlueprintIndex>();
+  std::vector<std::pair<Entity, Entity>> links;
+  for (Entity e : spawned) {
+    uint32_t b = staging.getComponent<const BlueprintIndex>(e).value;
+    if (b >= l.entityBlueprints.size()) {
+      throw std::runtime_error("Blueprint index out of range!");
+    }
+    const EntityBlueprint &i = l.entityBlueprints[b];
+    if (i.data.count("MESH")) {
+      staging.addComponent(e, makeRenderable(i));
+    }
+    if (staging.hasComponent<Parent>(e)) {
+      links.push_back({e, staging.getComponent<const Parent>(e).entity});
+    }
+  }
+  for (auto &[child, parent] : links) {
+    staging.removeComponent<Parent>(child);
+    setParent(staging, child, parent);
+  }
+  return spawned;
+}
+
 void Game::framebufferSizeCallback(GLFWwindow *window, int width, int height) {
   Game *game = static_cast<Game *>(glfwGetWindowUserPointer(window));
   if (!game)
@@ -240,17 +437,15 @@ void Game::cursorPosCallback(GLFWwindow *window, double x, double y) {
 
   glm::vec2 d = game->inputHandler.handleMouseMove(x, y) *
                 game->inputHandler.getMouseSensitivity();
-  auto cameras = game->world.query<CameraComponent>();
-  for (auto &entity : cameras) {
-    auto &camComp = game->world.getComponent<CameraComponent>(entity);
-
-    camComp.pitch += d.y;
-    if (camComp.constrainPitch) {
-      camComp.pitch = std::clamp(camComp.pitch, -89.0f, 89.0f);
-    }
-    camComp.yaw += d.x;
-    break;
-  }
+  game->world.view<CameraComponent>().each(
+      [&](Entity, CameraComponent &camComp) {
+        camComp.pitch += d.y;
+        if (camComp.constrainPitch) {
+          camComp.pitch = std::clamp(camComp.pitch, -89.0f, 89.0f);
+        }
+        camComp.yaw += d.x;
+        return false;
+      });
 }
 
 void Game::scrollCallback(GLFWwindow *window, double x, double y) {
@@ -266,13 +461,11 @@ void Game::scrollCallback(GLFWwindow *window, double x, double y) {
     return;
 
   game->inputHandler.handleScroll(x, y);
-  auto cameras = game->world.query<CameraComponent>();
-  for (auto &entity : cameras) {
-    auto &camComp = game->world.getComponent<CameraComponent>(entity);
-
-    camComp.fov = std::clamp(camComp.fov - game->inputHandler.getScroll().y,
-                             1.0f, 160.0f);
-  }
+  game->world.view<CameraComponent>().each(
+      [&](Entity, CameraComponent &camComp) {
+        camComp.fov = std::clamp(
+            camComp.fov - game->inputHandler.getScroll().y, 1.0f, 160.0f);
+      });
 }
 
 void Game::mouseButtonCallback(GLFWwindow *window, int button, int action,
@@ -289,11 +482,8 @@ void Game::mouseButtonCallback(GLFWwindow *window, int button, int action,
 }
 
 void Game::processInput() {
-  auto cameras = world.query<CameraComponent>();
   float deltaTime = (*window.getDelta());
-  for (auto &entity : cameras) {
-    auto &camComp = world.getComponent<CameraComponent>(entity);
-
+  world.view<CameraComponent>().each([&](Entity, CameraComponent &camComp) {
     if (inputHandler.isKeyHeld('W')) {
       camComp.position += camComp.front * deltaTime;
     }
@@ -312,8 +502,8 @@ void Game::processInput() {
       inputHandler.setMouseLocked(!inputHandler.getMouseLocked(),
                                   window.getGLFWwindow());
     }
-    break;
-  }
+    return false;
+  });
 };
 
 Game::~Game() {}
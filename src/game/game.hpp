@@ -1,17 +1,27 @@
 #pragma once
 
+#include "engine/compaction.hpp"
 #include "engine/ecs2.hpp"
+#include "engine/prefab.hpp"
+#include "engine/scheduler.hpp"
+#include "game/components/transform.hpp"
 #include "game/systems/camera_system.hpp"
 #include "game/systems/lightingSystem.hpp"
 #include "game/systems/render_system.hpp"
+#include "game/systems/transform_system.hpp"
 #include "platform/gui/guiHandler.hpp"
 #include "platform/input/inputHandler.hpp"
 #include "platform/rendering/camera.hpp"
 #include "platform/rendering/uniform_buffer_management.hpp"
 #include "platform/windowing/window.hpp"
+#include "util/frameArena.hpp"
 
 #include <GLFW/glfw3.h>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+class WorldLoader;
 
 class Game {
 public:
@@ -24,6 +34,11 @@ private:
   void processInput();
   void setupScene();
   void loadScene(std::string fp);
+  // Spawn the scene's entities into a staging world and return them. Only
+  // buildScene compiles blueprints, so prefabs stays empty when the scene is
+  // restored from its cache.
+  std::vector<Entity> buildScene(ECS2 &staging, const WorldLoader &l);
+  std::vector<Entity> restoreScene(ECS2 &staging, const WorldLoader &l);
 
   // Callbacks
   static void framebufferSizeCallback(GLFWwindow *window, int width,
@@ -45,15 +60,27 @@ private:
   UniformBufferManager uniformBufferManager;
   GuiHandler guiHandler;
 
+  // Transient per-frame allocations (draw lists, upload staging); reset at
+  // the start of every frame
+  FrameArena frameArena;
+
   // ECS
   ECS2 world;
+  // Compiled world file blueprints by entity name, for spawnBatch
+  std::unordered_map<std::string, Prefab> prefabs;
 
   // Systems
   RenderSystem renderSystem;
   CameraSystem cameraSystem;
+  TransformSystem transformSystem;
 
   LightingSystem lightingSystem;
 
+  Scheduler scheduler;
+  // Keeps Transform rows in spatial order, a little work each frame
+  SpatialCompactor<Transform> compactor{
+      [](const Transform &t) { return t.position; }};
+
   float deltaTime;
   float lastFrame;
   float totalTime;
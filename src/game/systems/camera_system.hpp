@@ -14,12 +14,8 @@ public:
     if (!target)
       return;
 
-    // Query for any entity with a CameraComponent
-    auto cameras = ecs.query<CameraComponent>();
-
-    for (auto e : cameras) {
-      auto &cam = ecs.getComponent<CameraComponent>(e);
-
+    // Walk every entity with a CameraComponent
+    ecs.view<CameraComponent>().each([&](Entity, CameraComponent &cam) {
       // Math: Calculate orientation
       glm::vec3 front;
       front.x = cos(glm::radians(cam.yaw)) * cos(glm::radians(cam.pitch));
@@ -39,7 +35,7 @@ public:
       target->nearPlane = cam.nearPlane;
       target->farPlane = cam.farPlane;
 
-      break; // Typically only update one main camera per frame
-    }
+      return false; // Typically only update one main camera per frame
+    });
   }
 };
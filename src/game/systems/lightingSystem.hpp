@@ -1,10 +1,15 @@
 #pragma once
 
 #include "engine/ecs2.hpp"
+#include "engine/scheduler.hpp"
 #include "platform/rendering/uniform_buffer_management.hpp"
+#include <game/components/hierarchy.hpp>
 #include <game/components/light.hpp>
-#include <game/components/transform.hpp>
+#include <algorithm>
+#include <cstddef>
 #include <glm/ext/quaternion_geometric.hpp>
+#include <span>
+#include <vector>
 
 constexpr int MAX_LIGHTS = 256;
 
@@ -31,6 +36,16 @@ struct LightSceneData {
 
 class LightingSystem {
   UniformBufferManager lightUBO;
+  LightSceneData sceneData{};
+  std::vector<Entity> lights;  // Every light; the first MAX_LIGHTS are shown
+  std::vector<uint32_t> slots; // Entity index -> index into lights + 1
+  size_t dirtyBegin = 0;       // Range of sceneData.lights to upload
+  size_t dirtyEnd = 0;
+  bool countDirty = true;
+  // Lights edited in place, rewritten a budget's worth per run
+  std::vector<Entity> pending;
+  std::vector<Entity> queued; // Entity index -> handle in pending, if any
+  TimeSlice rewrite;
 
 public:
   LightingSystem(unsigned int binding)
@@ -38,33 +53,144 @@ public:
     lightUBO.registerUniform("LightData", sizeof(LightSceneData), 16);
   }
 
+  // Tracks lights being added, removed or swapped out through world
+  // observers, so the light array is patched instead of rebuilt
+  void observe(ECS2 &ecs) {
+    auto sync = [this](ECS2 &world, std::span<const Entity> entities) {
+      for (Entity e : entities) {
+        this->sync(world, e);
+      }
+    };
+    ecs.onAdd<WorldTransform>(sync);
+    ecs.onRemove<WorldTransform>(sync);
+    ecs.onAdd<LightComponent>(sync);
+    ecs.onRemove<LightComponent>(sync);
+    ecs.onReplace<LightComponent>(sync);
+    ecs.onAdd<SpotLightComponent>(sync);
+    ecs.onRemove<SpotLightComponent>(sync);
+    ecs.onReplace<SpotLightComponent>(sync);
+  }
+
+  // Queues lights that moved or were edited in place since this system last
+  // ran and rewrites as many as the system's budget allows, carrying on
+  // next run, then uploads only the part of the block that changed
   void Update(ECS2 &ecs) {
-    LightSceneData sceneData{};
-    sceneData.numLights = 0;
-
-    auto lights = ecs.query<Transform, LightComponent>();
-
-    for (auto entity : lights) {
-      if (sceneData.numLights >= MAX_LIGHTS)
-        break;
-      auto &transform = ecs.getComponent<Transform>(entity);
-      auto &light = ecs.getComponent<LightComponent>(entity);
-
-      GPULight &data = sceneData.lights[sceneData.numLights];
-      data.position = transform.position;
-      data.direction = glm::normalize(transform.position);
-      data.color = light.color;
-      data.intensity = light.intensity;
-      data.type = light.type;
-      data.range = light.range;
-      if (light.type == 2 && ecs.hasComponent<SpotLightComponent>(entity)) {
-        auto &spot = ecs.getComponent<SpotLightComponent>(entity);
-        data.spotAngle = spot.outerAngle;
+    auto queue = [&](Entity e, const auto &...) {
+      uint32_t index = entityIndex(e);
+      if (index >= queued.size()) {
+        queued.resize(index + 1, NULL_ENTITY);
+      }
+      if (queued[index] != e) {
+        queued[index] = e;
+        pending.push_back(e);
+      }
+    };
+    ecs.view<Changed<WorldTransform>, const LightComponent>().each(queue);
+    ecs.view<const WorldTransform, Changed<LightComponent>>().each(queue);
+    ecs.view<Changed<SpotLightComponent>, With<LightComponent>>().each(queue);
+
+    bool done = rewrite.step(pending.size(), [&](size_t i) {
+      Entity e = pending[i];
+      if (queued[entityIndex(e)] == e) {
+        queued[entityIndex(e)] = NULL_ENTITY;
       }
+      sync(ecs, e);
+    });
+    if (done) {
+      pending.clear();
+    } else if (rewrite.position() * 2 > pending.size()) {
+      // Lights keep being queued while the slice catches up, so drop the
+      // rewritten front once it is most of the queue
+      pending.erase(pending.begin(), pending.begin() + rewrite.position());
+      rewrite = TimeSlice();
+    }
 
-      sceneData.numLights++;
+    if (dirtyBegin < dirtyEnd) {
+      lightUBO.setSubData("LightData", &sceneData.lights[dirtyBegin],
+                          offsetof(LightSceneData, lights) +
+                              dirtyBegin * sizeof(GPULight),
+                          (dirtyEnd - dirtyBegin) * sizeof(GPULight));
+    }
+    if (countDirty) {
+      sceneData.numLights =
+          static_cast<int>(std::min<size_t>(lights.size(), MAX_LIGHTS));
+      lightUBO.setSubData("LightData", &sceneData.numLights,
+                          offsetof(LightSceneData, numLights),
+                          sizeof(sceneData.numLights));
     }
+    dirtyBegin = dirtyEnd = 0;
+    countDirty = false;
+  }
+
+private:
+  // Brings e's entry in line with the world: inserted, rewritten or removed
+  void sync(ECS2 &ecs, Entity e) {
+    uint32_t index = entityIndex(e);
+    uint32_t slot = index < slots.size() ? slots[index] : 0;
+    bool isLight = ecs.hasComponent<WorldTransform>(e) &&
+                   ecs.hasComponent<LightComponent>(e);
+    // A slot holding another handle means one of the two was destroyed and
+    // its index reused; the dead one gives way to the live one
+    if (slot && lights[slot - 1] != e && ecs.isAlive(lights[slot - 1]))
+      return;
 
-    lightUBO.setData("LightData", &sceneData);
+    if (isLight && !slot) {
+      if (index >= slots.size()) {
+        slots.resize(index + 1, 0);
+      }
+      lights.push_back(e);
+      slots[index] = static_cast<uint32_t>(lights.size());
+      countDirty = true;
+      write(ecs, lights.size() - 1);
+    } else if (isLight) {
+      lights[slot - 1] = e;
+      write(ecs, slot - 1);
+    } else if (slot) {
+      // Swap the last light into the hole
+      size_t position = slot - 1;
+      Entity last = lights.back();
+      lights[position] = last;
+      slots[entityIndex(last)] = static_cast<uint32_t>(position + 1);
+      lights.pop_back();
+      slots[index] = 0;
+      countDirty = true;
+      if (position < lights.size()) {
+        write(ecs, position);
+      }
+    }
+  }
+
+  void write(ECS2 &ecs, size_t at) {
+    if (at >= MAX_LIGHTS)
+      return;
+    Entity entity = lights[at];
+    auto *transform = ecs.tryGetComponent<const WorldTransform>(entity);
+    auto *light = ecs.tryGetComponent<const LightComponent>(entity);
+    // A light swapped into a hole may have stopped being one in the same
+    // batch; its own event removes it shortly
+    if (!transform || !light)
+      return;
+
+    GPULight &data = sceneData.lights[at];
+    data = GPULight{};
+    glm::vec3 position = glm::vec3(transform->matrix[3]);
+    data.position = position;
+    data.direction = glm::normalize(position);
+    data.color = light->color;
+    data.intensity = light->intensity;
+    data.type = light->type;
+    data.range = light->range;
+    auto *spot = ecs.tryGetComponent<const SpotLightComponent>(entity);
+    if (light->type == 2 && spot) {
+      data.spotAngle = spot->outerAngle;
+    }
+
+    if (dirtyBegin == dirtyEnd) {
+      dirtyBegin = at;
+      dirtyEnd = at + 1;
+    } else {
+      dirtyBegin = std::min(dirtyBegin, at);
+      dirtyEnd = std::max(dirtyEnd, at + 1);
+    }
   }
 };
@@ -1,76 +1,451 @@
 #pragma once
 #include <engine/ecs2.hpp>
+#include <game/components/hierarchy.hpp>
 #include <game/components/renderable.hpp>
-#include <game/components/transform.hpp>
+#include <platform/rendering/camera.hpp>
+#include <platform/rendering/frustum.hpp>
+#include <platform/rendering/gl4.hpp>
+#include <platform/rendering/render_queue.hpp>
 #include <platform/rendering/shader.hpp>
 #include <platform/rendering/texture.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <span>
+#include <util/frameArena.hpp>
+#include <util/logger.hpp>
+#include <vector>
 
 class RenderSystem {
 public:
   explicit RenderSystem() {}
 
-  void update(ECS2 &ecs) {
+  ~RenderSystem() {
+    if (instanceBuffer)
+      glDeleteBuffers(1, &instanceBuffer);
+    if (commandBuffer)
+      glDeleteBuffers(1, &commandBuffer);
+    if (candidateBuffer)
+      glDeleteBuffers(1, &candidateBuffer);
+  }
+
+  RenderSystem(const RenderSystem &) = delete;
+  RenderSystem &operator=(const RenderSystem &) = delete;
+
+  // Entities the CPU left out of the last frame for being out of view.
+  // Those culled on the GPU are not counted; that would need a readback.
+  size_t culled() const { return culledCount; }
+
+  // Culls opaque instanced draws on the GPU with shader, a compute program
+  // from cull.comp. Needs multi-draw indirect; until then, or if the
+  // program failed to link, all culling stays on the CPU.
+  void setCullShader(Shader *shader) {
+    if (shader && !shader->linked()) {
+      Logger::Warn("Cull shader failed to link, culling on the CPU");
+      shader = nullptr;
+    }
+    cullShader = shader;
+  }
+
+  // The draw list is built in arena, which must outlive this call. Entities
+  // outside the camera's view are culled; the rest are ordered by depth.
+  void update(ECS2 &ecs, FrameArena &arena, const Camera3D &camera) {
     // Standard GL Setup
     glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
-    // Only get entities that have BOTH components
-    auto entities = ecs.query<Renderable>();
-
-    for (auto entity : entities) {
-      // Get references (use & to avoid copying large structs every frame)
-      auto &renderable = ecs.getComponent<Renderable>(entity);
-
-      if (renderable.shader)
-        renderable.shader->use();
-
-      glm::mat4 model = glm::mat4(1.0f);
-      Color c = Color{{1.0, 0.0, 0.5}};
-      if (ecs.hasComponent<Transform>(entity)) {
-        auto &transform = ecs.getComponent<Transform>(entity);
-        model = glm::translate(model, transform.position);
-        model = glm::rotate(model, glm::radians(transform.rotation.y),
-                            glm::vec3(0, 1, 0));
-        model = glm::rotate(model, glm::radians(transform.rotation.x),
-                            glm::vec3(1, 0, 0));
-        model = glm::rotate(model, glm::radians(transform.rotation.z),
-                            glm::vec3(0, 0, 1));
-        model = glm::scale(model, transform.scale);
-      }
+    // Gather first so the ECS walk and the GL calls stay apart. Entities
+    // without a WorldTransform draw at the origin, those without a Color
+    // in the fallback colour
+    size_t expected = ecs.query<Renderable>().size();
+    std::pmr::vector<DrawItem> draws(&arena);
+    BoxSet boxes(&arena);
+    draws.reserve(expected);
+    boxes.reserve(expected);
+    ecs.view<const Renderable, Optional<const WorldTransform>,
+             Optional<const Color>>()
+        .each([&](Entity, const Renderable &renderable,
+                  const WorldTransform *transform, const Color *color) {
+          if (!renderable.shader)
+            return;
+          glm::mat4 model = transform ? transform->matrix : glm::mat4(1.0f);
+          boxes.push(renderable.bounds, model);
+          glm::vec3 c = color ? glm::vec3(*color) : glm::vec3(1.0, 0.0, 0.5);
+          draws.push_back({&renderable, {model, c}});
+        });
 
-      renderable.shader->setMat4("uModel", model);
-
-      if (ecs.hasComponent<Color>(entity)) {
-        c = ecs.getComponent<Color>(entity);
+    // Only what survives culling is keyed and sorted, by the distance to
+    // its bounds' centre. Opaque instanced draws are left to the GPU when
+    // it can cull them; it appends instances in no fixed order, which only
+    // depth testing hides.
+    bool indirect = gl4::multiDrawIndirect;
+    bool gpuCulling = indirect && cullShader;
+    auto culledOnGpu = [&](const Renderable &renderable) {
+      return gpuCulling && renderable.shader->instanced &&
+             renderable.depthTesting;
+    };
+    Frustum frustum = Frustum::fromMatrix(camera.getProjectionMatrix() *
+                                          camera.getViewMatrix());
+    uint32_t *visible = arena.allocateArray<uint32_t>(draws.size());
+    size_t visibleCount = 0;
+    if (gpuCulling) {
+      for (uint32_t i = 0; i < draws.size(); i++) {
+        if (culledOnGpu(*draws[i].renderable) ||
+            frustum.intersects(boxes.center(i), boxes.extent(i)))
+          visible[visibleCount++] = i;
+      }
+    } else {
+      visibleCount = frustum.cull(boxes, visible);
+    }
+    culledCount = draws.size() - visibleCount;
+    RenderQueue queue(&arena);
+    queue.reserve(visibleCount);
+    for (size_t v = 0; v < visibleCount; v++) {
+      uint32_t item = visible[v];
+      const Renderable &renderable = *draws[item].renderable;
+      float depth = glm::length(boxes.center(item) - camera.position);
+      queue.push(RenderKey::make(renderable.depthTesting
+                                     ? RenderPass::Opaque
+                                     : RenderPass::Overlay,
+                                 renderable.shader->ID,
+                                 materialId(renderable),
+                                 geometryId(renderable), depth),
+                 item);
+    }
+    queue.sort();
+    // Draws that differ only in model matrix and colour are adjacent after
+    // sorting. Each such batch is drawn instanced if its shader has an
+    // instanced variant. With multi-draw indirect every instanced batch
+    // becomes a command and runs of them sharing a shader and textures go
+    // out in one call, whatever meshes they use.
+    std::span<const RenderQueue::Entry> sorted = queue.sorted();
+    std::pmr::vector<Batch> batches(&arena);
+    std::pmr::vector<InstanceData> instances(&arena);
+    std::pmr::vector<CullCandidate> candidates(&arena);
+    std::pmr::vector<gl4::DrawElementsIndirectCommand> commands(&arena);
+    instances.reserve(sorted.size());
+    for (size_t begin = 0; begin < sorted.size();) {
+      const Renderable &first = *draws[sorted[begin].item].renderable;
+      size_t end = begin + 1;
+      while (end < sorted.size() &&
+             sameBatch(first, *draws[sorted[end].item].renderable)) {
+        end++;
       }
+      Batch batch{begin, end, NOT_INSTANCED, culledOnGpu(first)};
+      if (batch.gpuCulled) {
+        batch.firstInstance = candidates.size(); // Offset once all are known
+        for (size_t i = begin; i < end; i++) {
+          const DrawItem &draw = draws[sorted[i].item];
+          const Bounds &bounds = draw.renderable->bounds;
+          candidates.push_back({draw.instance.model,
+                                glm::vec4(draw.instance.color, 1.0f),
+                                bounds.center,
+                                static_cast<GLuint>(commands.size()),
+                                bounds.extent(), 0.0f});
+        }
+      } else if (first.shader->instanced &&
+                 (indirect || end - begin >= MIN_INSTANCES)) {
+        batch.firstInstance = instances.size();
+        for (size_t i = begin; i < end; i++) {
+          instances.push_back(draws[sorted[i].item].instance);
+        }
+      }
+      if (indirect && batch.firstInstance != NOT_INSTANCED) {
+        // Culled batches start empty and are filled in by the GPU
+        commands.push_back(
+            {first.indexCount,
+             batch.gpuCulled ? 0 : static_cast<GLuint>(end - begin),
+             first.firstIndex, first.baseVertex, 0});
+      }
+      batches.push_back(batch);
+      begin = end;
+    }
+    // GPU culled instances go after the CPU's in the instance buffer
+    for (size_t b = 0, c = 0; b < batches.size(); b++) {
+      Batch &batch = batches[b];
+      if (batch.gpuCulled)
+        batch.firstInstance += instances.size();
+      if (indirect && batch.firstInstance != NOT_INSTANCED)
+        commands[c++].baseInstance = static_cast<GLuint>(batch.firstInstance);
+    }
+    uploadInstances(instances, candidates.size());
+    uploadCommands(commands);
+    dispatchCulling(candidates);
 
-      renderable.shader->setVec3("uColor", c);
+    const Shader *shader = nullptr;
+    const std::vector<Texture *> *textures = &noTextures;
+    unsigned int vao = 0;
+    bool depthTesting = true;
+    size_t command = 0; // Next entry of commands
+    for (size_t b = 0; b < batches.size(); b++) {
+      const Batch &batch = batches[b];
+      const Renderable &renderable =
+          *draws[sorted[batch.begin].item].renderable;
+      bool instanced = batch.firstInstance != NOT_INSTANCED;
+      Shader *program =
+          instanced ? renderable.shader->instanced : renderable.shader;
 
-      // 1. Bind textures
-      for (size_t i = 0; i < renderable.textures.size(); ++i) {
-        renderable.textures[i]->bind(GL_TEXTURE0 + static_cast<int>(i));
+      if (program != shader) {
+        shader = program;
+        program->use();
+      }
+      if (renderable.textures != *textures) {
+        bindTextures(*textures, renderable.textures);
+        textures = &renderable.textures;
+      }
+      if (renderable.vao != vao) {
+        vao = renderable.vao;
+        glBindVertexArray(vao);
+      }
+      if (renderable.depthTesting != depthTesting) {
+        depthTesting = renderable.depthTesting;
+        if (depthTesting)
+          glEnable(GL_DEPTH_TEST);
+        else
+          glDisable(GL_DEPTH_TEST);
       }
 
-      // 2. Draw
-      glBindVertexArray(renderable.vao);
-      if (renderable.depthTesting) {
-        glDrawElements(renderable.drawMode, renderable.indexCount,
-                       GL_UNSIGNED_INT, 0);
+      const void *firstIndex = reinterpret_cast<const void *>(
+          renderable.firstIndex * sizeof(unsigned int));
+      if (instanced && indirect) {
+        // Base instances pick each command's instances, so the attributes
+        // stay at the start of the buffer
+        size_t count = 1;
+        while (b + count < batches.size() &&
+               sameSubmission(renderable,
+                              *draws[sorted[batches[b + count].begin].item]
+                                   .renderable)) {
+          count++;
+        }
+        pointInstances(vao, 0);
+        gl4::MultiDrawElementsIndirect(
+            renderable.drawMode, GL_UNSIGNED_INT,
+            reinterpret_cast<const void *>(
+                command * sizeof(gl4::DrawElementsIndirectCommand)),
+            static_cast<GLsizei>(count), 0);
+        command += count;
+        b += count - 1;
+      } else if (instanced) {
+        pointInstances(vao, batch.firstInstance);
+        glDrawElementsInstancedBaseVertex(
+            renderable.drawMode, renderable.indexCount, GL_UNSIGNED_INT,
+            firstIndex, static_cast<GLsizei>(batch.end - batch.begin),
+            renderable.baseVertex);
       } else {
-        glDisable(GL_DEPTH_TEST);
-        glDrawElements(renderable.drawMode, renderable.indexCount,
-                       GL_UNSIGNED_INT, 0);
-        glEnable(GL_DEPTH_TEST);
+        for (size_t i = batch.begin; i < batch.end; i++) {
+          const InstanceData &instance = draws[sorted[i].item].instance;
+          program->setMat4("uModel", instance.model);
+          program->setVec3("uColor", instance.color);
+          glDrawElementsBaseVertex(renderable.drawMode, renderable.indexCount,
+                                   GL_UNSIGNED_INT, firstIndex,
+                                   renderable.baseVertex);
+        }
       }
-      glBindVertexArray(0);
+    }
+
+    // Leave the state as the next frame expects it
+    glBindVertexArray(0);
+    bindTextures(*textures, noTextures);
+    if (!depthTesting)
+      glEnable(GL_DEPTH_TEST);
+  }
+
+private:
+  // Per-instance vertex attributes: the model matrix at locations 4-7 and
+  // the colour at 8, matching the *Instanced.vert shaders
+  struct InstanceData {
+    glm::mat4 model;
+    glm::vec3 color;
+  };
+
+  struct DrawItem {
+    const Renderable *renderable;
+    InstanceData instance;
+  };
+
+  static_assert(sizeof(InstanceData) == 19 * sizeof(float),
+                "cull.comp writes instances as 19 packed floats");
+
+  // An instance for cull.comp to test: its local bounds, and the command
+  // to add it to if visible. Laid out as the shader's std430 Candidate.
+  struct CullCandidate {
+    glm::mat4 model;
+    glm::vec4 color;
+    glm::vec3 center;
+    GLuint command;
+    glm::vec3 extent;
+    float pad;
+  };
+  static_assert(sizeof(CullCandidate) == 112, "std430 Candidate is 112 bytes");
+
+  // A run of the sorted queue sharing all GPU state
+  struct Batch {
+    size_t begin;
+    size_t end;
+    size_t firstInstance; // Into the instance buffer, or NOT_INSTANCED
+    bool gpuCulled;       // Instances are tested and written by cull.comp
+  };
+
+  static constexpr size_t NOT_INSTANCED = SIZE_MAX;
+  // Below this a batch is cheaper to draw one by one than to re-point the
+  // instance attributes for
+  static constexpr size_t MIN_INSTANCES = 2;
+  static constexpr GLuint INSTANCE_LOCATION = 4;
+  static constexpr size_t CULL_GROUP_SIZE = 64; // cull.comp's local_size_x
 
-      // 3. Unbind
-      for (size_t i = 0; i < renderable.textures.size(); ++i) {
-        renderable.textures[i]->unbind(GL_TEXTURE0 + static_cast<int>(i));
+  static bool sameBatch(const Renderable &a, const Renderable &b) {
+    return sameSubmission(a, b) && a.indexCount == b.indexCount &&
+           a.firstIndex == b.firstIndex && a.baseVertex == b.baseVertex;
+  }
+
+  // Whether two batches can share one multi-draw: everything but the mesh
+  // range and instances must match
+  static bool sameSubmission(const Renderable &a, const Renderable &b) {
+    return a.shader == b.shader && a.vao == b.vao &&
+           a.drawMode == b.drawMode && a.depthTesting == b.depthTesting &&
+           a.textures == b.textures;
+  }
+
+  // Replaces the instance buffer's contents with this frame's instances,
+  // leaving room after them for gpuInstances more. The buffer is orphaned
+  // rather than overwritten so the driver need not wait for last frame's
+  // draws.
+  void uploadInstances(std::span<const InstanceData> instances,
+                       size_t gpuInstances) {
+    size_t total = instances.size() + gpuInstances;
+    if (total == 0)
+      return;
+    if (!instanceBuffer)
+      glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    if (total > instanceCapacity) {
+      instanceCapacity = std::max(total, instanceCapacity * 2);
+    }
+    glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(InstanceData),
+                 nullptr, GL_STREAM_DRAW);
+    if (!instances.empty()) {
+      glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size_bytes(),
+                      instances.data());
+    }
+  }
+
+  void uploadCommands(
+      std::span<const gl4::DrawElementsIndirectCommand> commands) {
+    if (commands.empty())
+      return;
+    if (!commandBuffer)
+      glGenBuffers(1, &commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if (commands.size() > commandCapacity) {
+      commandCapacity = std::max(commands.size(), commandCapacity * 2);
+    }
+    glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                 commandCapacity * sizeof(gl4::DrawElementsIndirectCommand),
+                 nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size_bytes(),
+                    commands.data());
+  }
+
+  // Runs cull.comp over the candidates. The visible ones are written to
+  // the instance buffer from their command's base instance on and counted
+  // in its instanceCount, where the draws read them without a round trip
+  // through the CPU.
+  void dispatchCulling(std::span<const CullCandidate> candidates) {
+    if (candidates.empty())
+      return;
+    if (!candidateBuffer)
+      glGenBuffers(1, &candidateBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, candidateBuffer);
+    if (candidates.size() > candidateCapacity) {
+      candidateCapacity = std::max(candidates.size(), candidateCapacity * 2);
+    }
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 candidateCapacity * sizeof(CullCandidate), nullptr,
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, candidates.size_bytes(),
+                    candidates.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, candidateBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, instanceBuffer);
+    cullShader->use();
+    cullShader->setInt("uCandidateCount", static_cast<int>(candidates.size()));
+    GLuint groups = static_cast<GLuint>(
+        (candidates.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE);
+    gl4::DispatchCompute(groups, 1, 1);
+    // The commands and instances are read next as draw arguments and
+    // vertex attributes
+    gl4::MemoryBarrier(GL_COMMAND_BARRIER_BIT |
+                       GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+  }
+
+  // Points the bound VAO's instance attributes at a batch's instances.
+  // Without base instances (GL < 4.2) the attribute offsets move instead.
+  void pointInstances(unsigned int vao, size_t firstInstance) {
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    bool fresh = std::find(instancedVaos.begin(), instancedVaos.end(), vao) ==
+                 instancedVaos.end();
+    if (fresh) {
+      instancedVaos.push_back(vao);
+    }
+    size_t base = firstInstance * sizeof(InstanceData);
+    // The matrix takes one location per column, the colour the one after
+    for (GLuint c = 0; c < 5; c++) {
+      GLuint location = INSTANCE_LOCATION + c;
+      size_t offset = c < 4 ? offsetof(InstanceData, model) +
+                                  c * sizeof(glm::vec4)
+                            : offsetof(InstanceData, color);
+      glVertexAttribPointer(location, c < 4 ? 4 : 3, GL_FLOAT, GL_FALSE,
+                            sizeof(InstanceData),
+                            reinterpret_cast<void *>(base + offset));
+      if (fresh) {
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
       }
     }
   }
 
-private:
+  // Texture sets stand in for materials; equal sets get equal ids
+  static uint32_t materialId(const Renderable &renderable) {
+    uint32_t hash = 0;
+    for (const Texture *texture : renderable.textures) {
+      hash = (hash ^ texture->ID) * 16777619u;
+    }
+    return hash;
+  }
+
+  // The VAO and the mesh's place in it
+  static uint32_t geometryId(const Renderable &renderable) {
+    return renderable.vao * 2654435761u ^ renderable.firstIndex;
+  }
+
+  // Switches the texture units from one set to another, unbinding units
+  // the new set leaves empty
+  static void bindTextures(const std::vector<Texture *> &from,
+                           const std::vector<Texture *> &to) {
+    for (size_t t = 0; t < to.size(); ++t) {
+      if (t >= from.size() || from[t] != to[t])
+        to[t]->bind(GL_TEXTURE0 + static_cast<int>(t));
+    }
+    for (size_t t = to.size(); t < from.size(); ++t) {
+      from[t]->unbind(GL_TEXTURE0 + static_cast<int>(t));
+    }
+  }
+
+  static inline const std::vector<Texture *> noTextures;
+
+  GLuint instanceBuffer = 0;
+  size_t instanceCapacity = 0;             // In instances
+  GLuint commandBuffer = 0;                // GL_DRAW_INDIRECT_BUFFER
+  size_t commandCapacity = 0;              // In commands
+  GLuint candidateBuffer = 0;              // GL_SHADER_STORAGE_BUFFER
+  size_t candidateCapacity = 0;            // In candidates
+  Shader *cullShader = nullptr;
+  std::vector<unsigned int> instancedVaos; // Have instance attributes set up
+
+  size_t culledCount = 0;
+
   float clearColor[4] = {0.5, 0.5, 0.5, 1.0};
 };
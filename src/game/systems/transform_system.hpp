@@ -0,0 +1,159 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+#include "game/components/hierarchy.hpp"
+#include "game/components/transform.hpp"
+#include "game/utils/transformUtils.hpp"
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Keeps WorldTransform in sync with Transform and the Parent/Children
+// hierarchy. Nodes are kept in breadth-first (level) order, so every parent
+// is updated before its children and one linear pass over flat arrays
+// propagates changes. Only subtrees under a changed Transform are
+// recomputed; the order itself is rebuilt when the hierarchy changes.
+//
+// The level order lives only in this index. Component rows stay where the
+// SpatialCompactor puts them, so each recomputed node still looks up its
+// Transform and WorldTransform by entity.
+class TransformSystem {
+public:
+  void update(ECS2 &ecs) {
+    bool anyDirty = false;
+    if (hierarchyChanged(ecs)) {
+      rebuild(ecs);
+      anyDirty = true;
+    }
+
+    ecs.view<Changed<Transform>>().each([&](Entity e) {
+      uint32_t index = entityIndex(e);
+      if (index < slots.size() && slots[index]) {
+        dirty[slots[index] - 1] = 1;
+        anyDirty = true;
+      }
+    });
+    if (!anyDirty)
+      return;
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const Node &node = nodes[i];
+      bool parentDirty = node.parent != NO_PARENT && dirty[node.parent];
+      if (!dirty[i] && !parentDirty)
+        continue;
+      dirty[i] = 1;
+
+      glm::mat4 local =
+          transformToMat4(ecs.getComponent<const Transform>(node.entity));
+      worlds[i] =
+          node.parent == NO_PARENT ? local : worlds[node.parent] * local;
+      if (auto *world = ecs.tryGetComponent<WorldTransform>(node.entity)) {
+        world->matrix = worlds[i];
+      }
+    }
+    std::fill(dirty.begin(), dirty.end(), 0);
+  }
+
+private:
+  static constexpr uint32_t NO_PARENT = UINT32_MAX;
+
+  struct Node {
+    Entity entity;
+    uint32_t parent; // Index into nodes, always lower than this node's
+  };
+
+  bool hierarchyChanged(ECS2 &ecs) {
+    size_t transforms = ecs.query<Transform>().size();
+    size_t parents = ecs.query<Parent>().size();
+    bool changed = transforms != transformCount || parents != parentCount;
+    transformCount = transforms;
+    parentCount = parents;
+
+    // Every view is built on every run, even once the answer is known, so
+    // their queries are all registered on the serial first frame
+    auto added = ecs.view<Added<Transform>>();
+    auto reparented = ecs.view<Changed<Parent>>();
+    auto regrouped = ecs.view<Changed<Children>>();
+    auto found = [&](Entity) {
+      changed = true;
+      return false;
+    };
+    if (!changed)
+      added.each(found);
+    if (!changed)
+      reparented.each(found);
+    if (!changed)
+      regrouped.each(found);
+    return changed;
+  }
+
+  bool hasTransformParent(ECS2 &ecs, Entity e) {
+    if (!ecs.hasComponent<Parent>(e))
+      return false;
+    Entity parent = ecs.getComponent<const Parent>(e).entity;
+    return ecs.hasComponent<Transform>(parent);
+  }
+
+  void rebuild(ECS2 &ecs) {
+    for (const Node &node : nodes) {
+      slots[entityIndex(node.entity)] = 0;
+    }
+    nodes.clear();
+
+    const auto &transforms = ecs.query<Transform>();
+    for (Entity e : transforms) {
+      if (!hasTransformParent(ecs, e)) {
+        push(e, NO_PARENT);
+      }
+    }
+    expand(ecs, 0);
+
+    // Entities whose parent does not list them in Children are not reached
+    // from a root; treat them as roots rather than dropping them
+    for (Entity e : transforms) {
+      uint32_t index = entityIndex(e);
+      if (index < slots.size() && slots[index])
+        continue;
+      size_t first = nodes.size();
+      push(e, NO_PARENT);
+      expand(ecs, first);
+    }
+
+    worlds.resize(nodes.size());
+    dirty.assign(nodes.size(), 1);
+  }
+
+  // Breadth-first walk from nodes[first] onwards, appending children
+  void expand(ECS2 &ecs, size_t first) {
+    for (size_t i = first; i < nodes.size(); i++) {
+      Entity e = nodes[i].entity;
+      if (!ecs.hasComponent<Children>(e))
+        continue;
+      for (Entity child : ecs.getComponent<const Children>(e).entities) {
+        uint32_t index = entityIndex(child);
+        bool visited = index < slots.size() && slots[index];
+        if (visited || !ecs.hasComponent<Transform>(child) ||
+            !ecs.hasComponent<Parent>(child) ||
+            ecs.getComponent<const Parent>(child).entity != e)
+          continue;
+        push(child, static_cast<uint32_t>(i));
+      }
+    }
+  }
+
+  void push(Entity e, uint32_t parent) {
+    uint32_t index = entityIndex(e);
+    if (index >= slots.size()) {
+      slots.resize(index + 1, 0);
+    }
+    nodes.push_back({e, parent});
+    slots[index] = static_cast<uint32_t>(nodes.size());
+  }
+
+  std::vector<Node> nodes;       // Level order
+  std::vector<glm::mat4> worlds; // World matrix per node
+  std::vector<uint8_t> dirty;    // Per node, only set during update()
+  std::vector<uint32_t> slots;   // Entity index -> node index + 1
+  size_t transformCount = 0;
+  size_t parentCount = 0;
+};
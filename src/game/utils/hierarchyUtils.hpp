@@ -0,0 +1,77 @@
+#pragma once
+
+#include "engine/ecs2.hpp"
+#include "game/components/hierarchy.hpp"
+#include <algorithm>
+#include <span>
+#include <unordered_map>
+
+// Detaches child from its parent, if it has one
+inline void clearParent(ECS2 &ecs, Entity child) {
+  if (!ecs.hasComponent<Parent>(child))
+    return;
+  Entity parent = ecs.getComponent<const Parent>(child).entity;
+  if (ecs.hasComponent<Children>(parent)) {
+    auto &siblings = ecs.getComponent<Children>(parent).entities;
+    siblings.erase(std::remove(siblings.begin(), siblings.end(), child),
+                   siblings.end());
+  }
+  ecs.removeComponent<Parent>(child);
+}
+
+// Attaches child to parent, moving it from any previous parent. Returns
+// false and changes nothing if that would create a cycle.
+inline bool setParent(ECS2 &ecs, Entity child, Entity parent) {
+  for (Entity e = parent; e != NULL_ENTITY;) {
+    if (e == child)
+      return false;
+    e = ecs.hasComponent<Parent>(e) ? ecs.getComponent<const Parent>(e).entity
+                                    : NULL_ENTITY;
+  }
+
+  clearParent(ecs, child);
+  ecs.addComponent(child, Parent{parent});
+  if (!ecs.hasComponent<Children>(parent)) {
+    ecs.addComponent(parent, Children{});
+  }
+  ecs.getComponent<Children>(parent).entities.push_back(child);
+  return true;
+}
+
+// Rewrites Parent/Children handles after ECS2::migrate, which returned
+// `moved[i]` for `original[i]`. Links to entities that were not moved are
+// dropped, since those handles belong to the old world.
+inline void remapHierarchy(ECS2 &ecs, std::span<const Entity> original,
+                           std::span<const Entity> moved) {
+  std::unordered_map<Entity, Entity> remap;
+  for (size_t i = 0; i < original.size(); i++) {
+    if (moved[i] != NULL_ENTITY) {
+      remap[original[i]] = moved[i];
+    }
+  }
+  auto lookup = [&](Entity e) {
+    auto it = remap.find(e);
+    return it == remap.end() ? NULL_ENTITY : it->second;
+  };
+
+  for (Entity e : moved) {
+    if (e == NULL_ENTITY)
+      continue;
+    if (ecs.hasComponent<Parent>(e)) {
+      Entity parent = lookup(ecs.getComponent<const Parent>(e).entity);
+      if (parent == NULL_ENTITY) {
+        ecs.removeComponent<Parent>(e);
+      } else {
+        ecs.getComponent<Parent>(e).entity = parent;
+      }
+    }
+    if (ecs.hasComponent<Children>(e)) {
+      auto &children = ecs.getComponent<Children>(e).entities;
+      for (Entity &child : children)
+        child = lookup(child);
+      children.erase(
+          std::remove(children.begin(), children.end(), NULL_ENTITY),
+          children.end());
+    }
+  }
+}
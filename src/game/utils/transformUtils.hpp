@@ -4,12 +4,16 @@
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/glm.hpp>
 
-inline glm::mat4 transformToMat4(Transform &transform) {
+// Local matrix of a Transform. Rotation is in degrees, applied Y, X, Z.
+inline glm::mat4 transformToMat4(const Transform &transform) {
   glm::mat4 model = glm::mat4(1.0f);
   model = glm::translate(model, transform.position);
-  model = glm::rotate(model, transform.rotation.x, glm::vec3(1, 0, 0));
-  model = glm::rotate(model, transform.rotation.y, glm::vec3(0, 1, 0));
-  model = glm::rotate(model, transform.rotation.z, glm::vec3(0, 0, 1));
+  model = glm::rotate(model, glm::radians(transform.rotation.y),
+                      glm::vec3(0, 1, 0));
+  model = glm::rotate(model, glm::radians(transform.rotation.x),
+                      glm::vec3(1, 0, 0));
+  model = glm::rotate(model, glm::radians(transform.rotation.z),
+                      glm::vec3(0, 0, 1));
   model = glm::scale(model, transform.scale);
   return model;
 }
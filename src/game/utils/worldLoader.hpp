@@ -12,6 +12,7 @@
 const std::string WL_SHADER_BEGIN = "BEGINSHADER";
 const std::string WL_SHADER_VERT = "SHADERVERT";
 const std::string WL_SHADER_FRAG = "SHADERFRAG";
+const std::string WL_SHADER_INSTANCED = "SHADERINSTANCEDVERT";
 const std::string WL_SHADER_END = "ENDSHADER";
 
 const std::string WL_MESH_BEGIN = "BEGINMESH";
@@ -34,7 +35,7 @@ template <typename K, typename V> class WorldLoaderObject {
 public:
   V &operator[](const K &index) { return data[index]; }
   bool contains(const K &index) { return data.find(index) != data.end(); }
-  std::map<K, V> all() { return data; }
+  const std::map<K, V> &all() const { return data; }
 };
 
 enum WorldLoaderReadPhase { FIND = 0, SHADER, MESH, TEXTURE, ENTITY };
@@ -50,6 +51,8 @@ struct EntityBlueprint {
 class WorldLoader {
 public:
   WorldLoaderObject<std::string, std::vector<std::string>> shaderObjects;
+  // Optional vertex shader for instanced draws, by shader name
+  WorldLoaderObject<std::string, std::string> instancedShaderObjects;
   WorldLoaderObject<std::string, std::string> meshObjects;
   WorldLoaderObject<std::string, std::string> textureObjects;
   std::vector<EntityBlueprint> entityBlueprints;
@@ -108,6 +111,10 @@ public:
           } else if (line.substr(0, WL_SHADER_FRAG.size()) == WL_SHADER_FRAG) {
             shaderObjects[currentObjectName].push_back(
                 line.substr(WL_SHADER_FRAG.size()));
+          } else if (line.substr(0, WL_SHADER_INSTANCED.size()) ==
+                     WL_SHADER_INSTANCED) {
+            instancedShaderObjects[currentObjectName] =
+                line.substr(WL_SHADER_INSTANCED.size());
           }
           break;
 
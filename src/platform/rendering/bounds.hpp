@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include <span>
+
+// Local-space bounds of a mesh: an axis-aligned box and a sphere around the
+// same centre. The sphere's radius is measured to the farthest vertex, so it
+// is usually tighter than the box's half diagonal.
+struct Bounds {
+  glm::vec3 min = glm::vec3(0.0f);
+  glm::vec3 max = glm::vec3(0.0f);
+  glm::vec3 center = glm::vec3(0.0f);
+  float radius = 0.0f;
+
+  glm::vec3 extent() const { return (max - min) * 0.5f; }
+
+  // vertices holds `stride` floats per vertex with the position first
+  static Bounds of(std::span<const float> vertices, size_t stride) {
+    Bounds bounds;
+    if (vertices.size() < 3)
+      return bounds;
+    bounds.min = bounds.max = position(vertices, 0);
+    for (size_t v = stride; v + 3 <= vertices.size(); v += stride) {
+      glm::vec3 p = position(vertices, v);
+      bounds.min = glm::min(bounds.min, p);
+      bounds.max = glm::max(bounds.max, p);
+    }
+    bounds.center = (bounds.min + bounds.max) * 0.5f;
+    float radius2 = 0.0f;
+    for (size_t v = 0; v + 3 <= vertices.size(); v += stride) {
+      glm::vec3 d = position(vertices, v) - bounds.center;
+      radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    bounds.radius = std::sqrt(radius2);
+    return bounds;
+  }
+
+private:
+  static glm::vec3 position(std::span<const float> vertices, size_t v) {
+    return glm::vec3(vertices[v], vertices[v + 1], vertices[v + 2]);
+  }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "platform/rendering/bounds.hpp"
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <memory_resource>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// World-space boxes stored as centre and half extent, one array per
+// coordinate, so the culler can load 4 or 8 boxes into each register
+class BoxSet {
+public:
+  explicit BoxSet(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : cx(memory), cy(memory), cz(memory), ex(memory), ey(memory),
+        ez(memory) {}
+
+  void reserve(size_t count) {
+    for (std::pmr::vector<float> *lane : {&cx, &cy, &cz, &ex, &ey, &ez})
+      lane->reserve(count);
+  }
+
+  void push(const glm::vec3 &center, const glm::vec3 &extent) {
+    cx.push_back(center.x);
+    cy.push_back(center.y);
+    cz.push_back(center.z);
+    ex.push_back(extent.x);
+    ey.push_back(extent.y);
+    ez.push_back(extent.z);
+  }
+
+  // The local box of bounds under model, grown to stay axis aligned: each
+  // world axis gets the local extents projected onto it
+  void push(const Bounds &bounds, const glm::mat4 &model) {
+    glm::vec3 e = bounds.extent();
+    push(glm::vec3(model * glm::vec4(bounds.center, 1.0f)),
+         glm::abs(glm::vec3(model[0])) * e.x +
+             glm::abs(glm::vec3(model[1])) * e.y +
+             glm::abs(glm::vec3(model[2])) * e.z);
+  }
+
+  size_t size() const { return cx.size(); }
+  glm::vec3 center(size_t i) const { return glm::vec3(cx[i], cy[i], cz[i]); }
+  glm::vec3 extent(size_t i) const { return glm::vec3(ex[i], ey[i], ez[i]); }
+
+  std::pmr::vector<float> cx, cy, cz;
+  std::pmr::vector<float> ex, ey, ez;
+};
+
+// The six planes of a view volume, normals pointing inward and normalised so
+// a plane's value at a point is its distance
+struct Frustum {
+  glm::vec4 planes[6]; // Left, right, bottom, top, near, far
+
+  // Planes of a GL clip space (-w..w on every axis) projection
+  static Frustum fromMatrix(const glm::mat4 &viewProjection) {
+    const glm::mat4 &m = viewProjection;
+    auto row = [&](int r) {
+      return glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    };
+    Frustum frustum;
+    for (int axis = 0; axis < 3; axis++) {
+      frustum.planes[axis * 2] = row(3) + row(axis);
+      frustum.planes[axis * 2 + 1] = row(3) - row(axis);
+    }
+    for (glm::vec4 &plane : frustum.planes) {
+      float length = glm::length(glm::vec3(plane));
+      if (length > 0.0f)
+        plane /= length;
+    }
+    return frustum;
+  }
+
+  // Whether a box is at least partly inside. Conservative near the edges:
+  // a box beside a corner may pass though no plane separates it.
+  bool intersects(const glm::vec3 &center, const glm::vec3 &extent) const {
+    for (const glm::vec4 &plane : planes) {
+      glm::vec3 n(plane);
+      float reach = glm::dot(glm::abs(n), extent);
+      if (!(glm::dot(n, center) + plane.w + reach >= 0.0f))
+        return false;
+    }
+    return true;
+  }
+
+  // Writes the indices of the boxes that intersect to visible, in order,
+  // and returns how many there are. visible must have room for them all.
+  size_t cull(const BoxSet &boxes, uint32_t *visible) const {
+    const size_t count = boxes.size();
+    size_t kept = 0;
+    size_t i = 0;
+#if defined(__AVX__)
+    __m256 n[6][3], a[6][3], w[6];
+    for (int p = 0; p < 6; p++) {
+      for (int c = 0; c < 3; c++) {
+        n[p][c] = _mm256_set1_ps(planes[p][c]);
+        a[p][c] = _mm256_set1_ps(std::fabs(planes[p][c]));
+      }
+      w[p] = _mm256_set1_ps(planes[p].w);
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i + 8 <= count; i += 8) {
+      __m256 x = _mm256_loadu_ps(boxes.cx.data() + i);
+      __m256 y = _mm256_loadu_ps(boxes.cy.data() + i);
+      __m256 z = _mm256_loadu_ps(boxes.cz.data() + i);
+      __m256 ex = _mm256_loadu_ps(boxes.ex.data() + i);
+      __m256 ey = _mm256_loadu_ps(boxes.ey.data() + i);
+      __m256 ez = _mm256_loadu_ps(boxes.ez.data() + i);
+      __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+      for (int p = 0; p < 6; p++) {
+        __m256 d = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(x, n[p][0]),
+                          _mm256_mul_ps(y, n[p][1])),
+            _mm256_add_ps(_mm256_mul_ps(z, n[p][2]), w[p]));
+        __m256 reach = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(ex, a[p][0]),
+                          _mm256_mul_ps(ey, a[p][1])),
+            _mm256_mul_ps(ez, a[p][2]));
+        __m256 ahead =
+            _mm256_cmp_ps(_mm256_add_ps(d, reach), zero, _CMP_GE_OQ);
+        inside = _mm256_and_ps(inside, ahead);
+      }
+      unsigned bits = static_cast<unsigned>(_mm256_movemask_ps(inside));
+      // Every lane is written and only survivors advance, so there is no
+      // branch to mispredict on a mix of visible and culled boxes
+      for (unsigned lane = 0; lane < 8; lane++) {
+        visible[kept] = static_cast<uint32_t>(i + lane);
+        kept += (bits >> lane) & 1;
+      }
+    }
+#elif defined(__SSE2__)
+    __m128 n[6][3], a[6][3], w[6];
+    for (int p = 0; p < 6; p++) {
+      for (int c = 0; c < 3; c++) {
+        n[p][c] = _mm_set1_ps(planes[p][c]);
+        a[p][c] = _mm_set1_ps(std::fabs(planes[p][c]));
+      }
+      w[p] = _mm_set1_ps(planes[p].w);
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+      __m128 x = _mm_loadu_ps(boxes.cx.data() + i);
+      __m128 y = _mm_loadu_ps(boxes.cy.data() + i);
+      __m128 z = _mm_loadu_ps(boxes.cz.data() + i);
+      __m128 ex = _mm_loadu_ps(boxes.ex.data() + i);
+      __m128 ey = _mm_loadu_ps(boxes.ey.data() + i);
+      __m128 ez = _mm_loadu_ps(boxes.ez.data() + i);
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for (int p = 0; p < 6; p++) {
+        __m128 d = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(x, n[p][0]), _mm_mul_ps(y, n[p][1])),
+            _mm_add_ps(_mm_mul_ps(z, n[p][2]), w[p]));
+        __m128 reach = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(ex, a[p][0]), _mm_mul_ps(ey, a[p][1])),
+            _mm_mul_ps(ez, a[p][2]));
+        __m128 ahead = _mm_cmpge_ps(_mm_add_ps(d, reach), zero);
+        inside = _mm_and_ps(inside, ahead);
+      }
+      unsigned bits = static_cast<unsigned>(_mm_movemask_ps(inside));
+      // Every lane is written and only survivors advance, so there is no
+      // branch to mispredict on a mix of visible and culled boxes
+      for (unsigned lane = 0; lane < 4; lane++) {
+        visible[kept] = static_cast<uint32_t>(i + lane);
+        kept += (bits >> lane) & 1;
+      }
+    }
+#endif
+    for (; i < count; i++) {
+      if (intersects(boxes.center(i), boxes.extent(i)))
+        visible[kept++] = static_cast<uint32_t>(i);
+    }
+    return kept;
+  }
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// GL 4.x entry points the bundled glad (generated for 3.3 core) lacks. The
+// window asks for a 4.6 context, but drivers may hand out less, so every
+// feature has a flag and callers keep a 3.3 path for when it is false.
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+
+namespace gl4 {
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+  GLuint count;
+  GLuint instanceCount;
+  GLuint firstIndex;
+  GLint baseVertex;
+  GLuint baseInstance;
+};
+
+using LoadProc = void *(*)(const char *name);
+
+typedef void(APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(
+    GLenum mode, GLenum type, const void *indirect, GLsizei drawcount,
+    GLsizei stride);
+
+typedef void(APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint groupsX,
+                                                 GLuint groupsY,
+                                                 GLuint groupsZ);
+typedef void(APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+
+inline PFNGLMULTIDRAWELEMENTSINDIRECTPROC MultiDrawElementsIndirect = nullptr;
+inline PFNGLDISPATCHCOMPUTEPROC DispatchCompute = nullptr;
+inline PFNGLMEMORYBARRIERPROC MemoryBarrier = nullptr;
+
+// GL 4.3: glMultiDrawElementsIndirect, and with it base instances
+inline bool multiDrawIndirect = false;
+// GL 4.3: compute shaders and shader storage buffers
+inline bool computeShaders = false;
+
+inline bool versionAtLeast(GLint major, GLint minor) {
+  GLint haveMajor = 0, haveMinor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &haveMajor);
+  glGetIntegerv(GL_MINOR_VERSION, &haveMinor);
+  return haveMajor > major || (haveMajor == major && haveMinor >= minor);
+}
+
+// Call once the context is current and glad is loaded
+inline void load(LoadProc getProc) {
+  if (versionAtLeast(4, 3)) {
+    MultiDrawElementsIndirect = reinterpret_cast<
+        PFNGLMULTIDRAWELEMENTSINDIRECTPROC>(
+        getProc("glMultiDrawElementsIndirect"));
+    DispatchCompute = reinterpret_cast<PFNGLDISPATCHCOMPUTEPROC>(
+        getProc("glDispatchCompute"));
+    MemoryBarrier =
+        reinterpret_cast<PFNGLMEMORYBARRIERPROC>(getProc("glMemoryBarrier"));
+  }
+  multiDrawIndirect = MultiDrawElementsIndirect != nullptr;
+  computeShaders = DispatchCompute != nullptr && MemoryBarrier != nullptr;
+}
+
+} // namespace gl4
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <memory_resource>
+#include <span>
+#include <vector>
+
+// Draws are ordered by pass first, then by the GPU state they need, then by
+// depth, so equal state ends up adjacent and changes only at key boundaries.
+enum class RenderPass : uint8_t {
+  Opaque = 0,  // Depth tested, front to back
+  Overlay = 1, // Drawn over everything, back to front
+};
+
+// 64-bit sort key, most significant field first:
+//   pass:2 | shader:10 | material:14 | geometry:14 | depth:24
+// Geometry identifies the VAO and the mesh within it. Ids wider than their
+// field are truncated. That only costs ordering: the render loop compares
+// the actual state before binding anything.
+struct RenderKey {
+  static constexpr int DEPTH_BITS = 24;
+  static constexpr int GEOMETRY_BITS = 14;
+  static constexpr int MATERIAL_BITS = 14;
+  static constexpr int SHADER_BITS = 10;
+
+  static uint64_t make(RenderPass pass, uint32_t shader, uint32_t material,
+                       uint32_t geometry, float depth) {
+    uint32_t d = quantizeDepth(depth);
+    if (pass != RenderPass::Opaque) {
+      d = static_cast<uint32_t>(~d & mask(DEPTH_BITS)); // Back to front
+    }
+    uint64_t key = uint64_t(pass);
+    key = (key << SHADER_BITS) | (shader & mask(SHADER_BITS));
+    key = (key << MATERIAL_BITS) | (material & mask(MATERIAL_BITS));
+    key = (key << GEOMETRY_BITS) | (geometry & mask(GEOMETRY_BITS));
+    key = (key << DEPTH_BITS) | d;
+    return key;
+  }
+
+  // The bits of a non-negative float sort like the float itself, so the
+  // top bits make a logarithmic depth with no near/far range to pick
+  static uint32_t quantizeDepth(float depth) {
+    if (!(depth > 0.0f))
+      return 0;
+    return std::bit_cast<uint32_t>(depth) >> (32 - DEPTH_BITS);
+  }
+
+  static constexpr uint64_t mask(int bits) { return (uint64_t(1) << bits) - 1; }
+};
+
+// A frame's draws as (key, item) pairs, sorted by key with an LSD radix
+// sort. Items are indices into the caller's own draw list. Bytes every key
+// shares are skipped, which with few shaders and materials leaves only a
+// handful of passes.
+class RenderQueue {
+public:
+  struct Entry {
+    uint64_t key;
+    uint32_t item;
+  };
+
+  explicit RenderQueue(
+      std::pmr::memory_resource *memory = std::pmr::get_default_resource())
+      : entries(memory), scratch(memory) {}
+
+  void reserve(size_t count) { entries.reserve(count); }
+  void push(uint64_t key, uint32_t item) { entries.push_back({key, item}); }
+  void clear() { entries.clear(); }
+  size_t size() const { return entries.size(); }
+
+  // Stable, so draws with equal keys keep their submission order
+  void sort() {
+    if (entries.size() < 2)
+      return;
+    uint64_t first = entries[0].key;
+    uint64_t differing = 0;
+    for (const Entry &entry : entries) {
+      differing |= entry.key ^ first;
+    }
+    scratch.resize(entries.size());
+
+    uint32_t counts[RADIX];
+    for (int shift = 0; shift < 64; shift += 8) {
+      if (((differing >> shift) & 0xFF) == 0)
+        continue;
+      std::memset(counts, 0, sizeof(counts));
+      for (const Entry &entry : entries) {
+        counts[(entry.key >> shift) & 0xFF]++;
+      }
+      for (uint32_t b = 0, next = 0; b < RADIX; b++) {
+        uint32_t count = counts[b];
+        counts[b] = next;
+        next += count;
+      }
+      for (const Entry &entry : entries) {
+        scratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+      }
+      entries.swap(scratch);
+    }
+  }
+
+  std::span<const Entry> sorted() const { return entries; }
+
+private:
+  static constexpr uint32_t RADIX = 256;
+
+  std::pmr::vector<Entry> entries;
+  std::pmr::vector<Entry> scratch;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "glad/glad.h"
+#include "platform/rendering/gl4.hpp"
 #include "util/fileUtils.hpp"
 #include <glm/ext/matrix_float4x4.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -61,6 +62,9 @@ inline unsigned int compileProgram(std::vector<unsigned int> shaders) {
 class Shader {
 public:
   unsigned int ID;
+  // Same shader taking uModel and uColor as per-instance attributes
+  // (locations 4-7 and 8), or nullptr if there is none
+  Shader *instanced = nullptr;
 
   Shader(const char *vertexPath, const char *fragmentPath) {
     unsigned int vShader = compileShader(GL_VERTEX_SHADER, vertexPath);
@@ -68,6 +72,16 @@ public:
     unsigned int program = compileProgram({vShader, fShader});
     ID = program;
   }
+  // A compute program. GL_COMPUTE_SHADER needs GL 4.3; see gl4.hpp.
+  explicit Shader(const char *computePath) {
+    unsigned int cShader = compileShader(GL_COMPUTE_SHADER, computePath);
+    ID = compileProgram({cShader});
+  }
+  bool linked() const {
+    int success = 0;
+    glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    return success;
+  }
   void use() const { glUseProgram(ID); }
   void setBool(const std::string &name, bool value) {
 
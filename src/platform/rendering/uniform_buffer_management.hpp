@@ -5,6 +5,7 @@
 #include <map>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 
 class UniformBufferManager {
 public:
@@ -27,26 +28,51 @@ public:
       throw std::runtime_error("Uniform buffer overflow");
     }
 
-    offsets.emplace(name, alignedOffset);
-    sizes.emplace(name, dataSize);
+    uniforms.emplace(name, Range{alignedOffset, dataSize});
     nextOffset = alignedOffset + dataSize;
 
     Logger::Debug("Uniform \"%s\" registered at 0x%X", name.c_str(),
                   alignedOffset);
   }
 
-  void setData(const std::string &name, const void *data) {
-    auto it = offsets.find(name);
-    if (it == offsets.end()) {
-      throw std::runtime_error("Uniform not registered: " + name);
+  void setData(std::string_view name, const void *data) {
+    const Range &range = find(name);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, range.offset, range.size, data);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  }
+
+  // Updates bytes of the named uniform starting offset bytes into it
+  void setSubData(std::string_view name, const void *data, GLintptr offset,
+                  GLsizeiptr bytes) {
+    const Range &range = find(name);
+    if (offset < 0 || bytes < 0 || offset + bytes > range.size) {
+      throw std::runtime_error("Uniform range out of bounds: " +
+                               std::string(name));
     }
 
     glBindBuffer(GL_UNIFORM_BUFFER, ubo);
-    glBufferSubData(GL_UNIFORM_BUFFER, it->second, sizes.at(name), data);
+    glBufferSubData(GL_UNIFORM_BUFFER, range.offset + offset, bytes, data);
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
   }
 
 private:
+  struct Range {
+    GLsizeiptr offset;
+    GLsizeiptr size;
+  };
+
+  // Looked up by string_view so per-frame calls with literals never build
+  // a std::string
+  const Range &find(std::string_view name) const {
+    auto it = uniforms.find(name);
+    if (it == uniforms.end()) {
+      throw std::runtime_error("Uniform not registered: " +
+                               std::string(name));
+    }
+    return it->second;
+  }
+
   static GLsizeiptr align(GLsizeiptr offset, GLsizeiptr alignment) {
     return (offset + alignment - 1) & ~(alignment - 1);
   }
@@ -57,6 +83,5 @@ private:
   GLuint binding{};
 
   GLsizeiptr nextOffset = 0;
-  std::map<std::string, GLsizeiptr> offsets;
-  std::map<std::string, GLsizeiptr> sizes;
+  std::map<std::string, Range, std::less<>> uniforms;
 };
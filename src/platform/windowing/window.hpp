@@ -1,5 +1,6 @@
 #pragma once
 #include "glad/glad.h"
+#include "platform/rendering/gl4.hpp"
 #include "util/logger.hpp"
 #include <GLFW/glfw3.h>
 #include <stdexcept>
@@ -101,6 +102,7 @@ private:
   void initGLAD() {
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
       throw std::runtime_error("Failed to initialize GLAD");
+    gl4::load(reinterpret_cast<gl4::LoadProc>(glfwGetProcAddress));
   }
 
   void setupOpenGLState() {
@@ -0,0 +1,318 @@
+// ECS2 regression tests; `make test` builds and runs them. Each check that
+// fails prints its line, and the exit status is the number of failures.
+#include "engine/command_buffer.hpp"
+#include "engine/ecs2.hpp"
+#include "engine/scheduler.hpp"
+#include "engine/snapshot.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,             \
+                  #condition);                                                 \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+template <typename F> bool throwsOutOfRange(F &&f) {
+  try {
+    f();
+  } catch (const std::out_of_range &) {
+    return true;
+  }
+  return false;
+}
+
+template <StorageMode Mode> struct Health {
+  int value;
+};
+template <StorageMode Mode> struct Armor {
+  int value;
+};
+template <size_t N> struct Marker {
+  int value;
+};
+struct Label {
+  std::string value;
+};
+// Throws when moved while armed, to fail a command part way through a flush
+bool fuseArmed = false;
+struct Fuse {
+  Fuse() = default;
+  Fuse(const Fuse &) = default;
+  Fuse(Fuse &&) {
+    if (fuseArmed)
+      throw std::runtime_error("Fuse blew");
+  }
+  Fuse &operator=(const Fuse &) = default;
+  Fuse &operator=(Fuse &&) = default;
+};
+
+} // namespace
+
+template <StorageMode Mode> struct ComponentStorage<Health<Mode>> {
+  static constexpr StorageMode mode = Mode;
+};
+template <StorageMode Mode> struct ComponentStorage<Armor<Mode>> {
+  static constexpr StorageMode mode = Mode;
+};
+
+namespace {
+
+// A handle kept past destroyEntity must not reach the entity that reuses
+// its slot, whichever store the components live in
+template <StorageMode Mode> void staleHandleAfterRecycle() {
+  using H = Health<Mode>;
+  using A = Armor<Mode>;
+  ECS2 world;
+  Entity stale = world.createEntity();
+  world.addComponent(stale, A{1});
+  world.destroyEntity(stale);
+  Entity live = world.createEntity();
+  CHECK(entityIndex(live) == entityIndex(stale));
+  CHECK(live != stale);
+  world.addComponent(live, A{2});
+
+  world.addComponent(stale, H{7});
+  CHECK(!world.hasComponent<H>(live));
+  CHECK(world.query<H>().empty());
+  CHECK(!world.hasComponent<H>(stale));
+
+  CHECK(throwsOutOfRange([&] { world.getComponent<A>(stale); }));
+  CHECK(throwsOutOfRange([&] { world.getComponent<const A>(stale); }));
+  CHECK(throwsOutOfRange([&] { world.getTicks<A>(stale); }));
+  CHECK(world.tryGetComponent<A>(stale) == nullptr);
+  CHECK(world.getComponent<const A>(live).value == 2);
+}
+
+// Removing through a destroyed handle leaves the world as it was, and
+// through a recycled one leaves the entity now in the slot alone
+template <StorageMode Mode> void staleHandleRemove() {
+  using H = Health<Mode>;
+  ECS2 world;
+  Entity dead = world.createEntity();
+  world.addComponent(dead, H{1});
+  world.destroyEntity(dead);
+  world.removeComponent<H>(dead);
+  CHECK(world.query<H>().empty());
+
+  Entity live = world.createEntity();
+  CHECK(entityIndex(live) == entityIndex(dead));
+  world.addComponent(live, H{2});
+  world.removeComponent<H>(dead);
+  CHECK(world.hasComponent<H>(live));
+  CHECK(world.getComponent<const H>(live).value == 2);
+  CHECK(world.query<H>().size() == 1 && world.query<H>()[0] == live);
+}
+
+// Query::erase only removes members
+void queryEraseNonMember() {
+  Query query(Signature(1), Signature(0));
+  query.erase(makeEntity(1, 0));
+  Entity member = makeEntity(1, 0);
+  Entity recycled = makeEntity(1, 1);
+  query.insert(member);
+  query.erase(recycled);
+  query.erase(makeEntity(7, 0));
+  CHECK(query.getEntities().size() == 1);
+  query.erase(member);
+  CHECK(query.getEntities().empty());
+}
+
+// Systems on different threads may each be first to ask for a query
+template <size_t... N>
+void concurrentQueryRegistration(std::index_sequence<N...>) {
+  using H = Health<StorageMode::Map>;
+  ECS2 world;
+  for (int i = 0; i < 100; i++) {
+    Entity e = world.createEntity();
+    world.addComponent(e, H{i});
+    if (i % 2)
+      world.addComponent(e, Marker<0>{i});
+  }
+  // Component ids are still handed out on first use without a lock
+  (ComponentTypeManager::getId<Marker<N>>(), ...);
+
+  std::vector<size_t> sizes(sizeof...(N) * 2);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < sizes.size(); t++) {
+    threads.emplace_back([&, t] {
+      size_t which = t % sizeof...(N);
+      size_t size = 0;
+      ((which == N ? size = world.query<H, Without<Marker<N>>>().size()
+                   : 0),
+       ...);
+      sizes[t] = size;
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for (size_t t = 0; t < sizes.size(); t++) {
+    CHECK(sizes[t] == (t % sizeof...(N) == 0 ? 50u : 100u));
+  }
+}
+
+template <typename F> bool throwsRuntimeError(F &&f) {
+  try {
+    f();
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  return false;
+}
+
+// A snapshot loads back only under the key and component layout it was
+// saved with; anything else is rejected before the world is touched
+void snapshotKeyAndLayout() {
+  using H = Health<StorageMode::Archetype>;
+  using A = Armor<StorageMode::SparseSet>;
+  WorldSnapshot snapshot;
+  snapshot.registerComponent<H>("Health");
+  snapshot.registerComponent<A>("Armor");
+  snapshot.registerStringComponent(&Label::value, "Label");
+
+  ECS2 source;
+  Entity a = source.createEntity();
+  Entity b = source.createEntity();
+  source.addComponent(a, H{3});
+  source.addComponent(a, Label{"a"});
+  source.addComponent(b, A{4});
+  std::string path =
+      (std::filesystem::temp_directory_path() / "ecs2_test.snap").string();
+  snapshot.save(source, path, 42);
+
+  ECS2 restored;
+  snapshot.load(restored, path, 42);
+  CHECK(restored.getComponent<const H>(a).value == 3);
+  CHECK(restored.getComponent<const Label>(a).value == "a");
+  CHECK(restored.getComponent<const A>(b).value == 4);
+  CHECK(!restored.hasComponent<A>(a));
+
+  ECS2 wrongKey;
+  CHECK(throwsRuntimeError([&] { snapshot.load(wrongKey, path, 43); }));
+  CHECK(wrongKey.createEntity() == a);
+
+  WorldSnapshot grown = snapshot;
+  grown.registerComponent<Marker<0>>("Marker");
+  ECS2 wrongLayout;
+  CHECK(throwsRuntimeError([&] { grown.load(wrongLayout, path, 42); }));
+  CHECK(wrongLayout.createEntity() == a);
+  std::filesystem::remove(path);
+}
+
+// Buffers apply in key order, not in the order threads first recorded
+void commandsApplyInKeyOrder() {
+  using H = Health<StorageMode::SparseSet>;
+  ECS2 world;
+  CommandQueue queue;
+  auto record = [&](size_t key) {
+    CommandQueue::Scope scope(queue, key);
+    CommandBuffer &buffer = queue.local();
+    buffer.addComponent(buffer.createEntity(), H{static_cast<int>(key)});
+  };
+  std::thread(record, 1).join();
+  std::thread(record, 0).join();
+  queue.flush(world);
+
+  const auto &entities = world.query<H>();
+  CHECK(entities.size() == 2);
+  if (entities.size() == 2) {
+    Entity first = entityIndex(entities[0]) < entityIndex(entities[1])
+                       ? entities[0]
+                       : entities[1];
+    CHECK(world.getComponent<const H>(first).value == 0);
+  }
+}
+
+// A command that throws drops everything still queued, so the next flush
+// does not replay it
+void commandsClearedAfterThrow() {
+  using H = Health<StorageMode::SparseSet>;
+  ECS2 world;
+  Entity e = world.createEntity();
+  CommandQueue queue;
+  {
+    CommandQueue::Scope scope(queue, 0);
+    queue.local().addComponent(e, Fuse{});
+  }
+  {
+    CommandQueue::Scope scope(queue, 1);
+    queue.local().addComponent(e, H{5});
+  }
+  fuseArmed = true;
+  CHECK(throwsRuntimeError([&] { queue.flush(world); }));
+  fuseArmed = false;
+  CHECK(!world.hasComponent<H>(e));
+
+  queue.flush(world);
+  CHECK(!world.hasComponent<H>(e));
+  CHECK(!world.hasComponent<Fuse>(e));
+}
+
+// A budgeted system picks sliced work up where its previous run stopped,
+// and every item is visited once per pass
+void timeSliceResumesAcrossRuns() {
+  ECS2 world;
+  Scheduler scheduler(world, 1);
+  TimeSlice slice;
+  std::vector<int> visits(20, 0);
+  size_t runs = 0;
+  size_t passes = 0;
+  scheduler.addSystem(
+      "sliced", Reads<>(), Writes<>(),
+      [&](ECS2 &) {
+        runs++;
+        bool done = slice.step(visits.size(), [&](size_t i) {
+          visits[i]++;
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+        passes += done;
+      },
+      SystemThread::Any, SystemSchedule{0.0f, 2.0f});
+  while (passes == 0 && runs < 100) {
+    scheduler.run();
+    if (passes == 0) {
+      CHECK(slice.position() > 0 && slice.position() < visits.size());
+    }
+  }
+  CHECK(passes == 1);
+  CHECK(runs > 1);
+  for (int count : visits) {
+    CHECK(count == 1);
+  }
+}
+
+} // namespace
+
+int main() {
+  staleHandleAfterRecycle<StorageMode::Map>();
+  staleHandleAfterRecycle<StorageMode::SparseSet>();
+  staleHandleAfterRecycle<StorageMode::Archetype>();
+  staleHandleRemove<StorageMode::Map>();
+  staleHandleRemove<StorageMode::SparseSet>();
+  staleHandleRemove<StorageMode::Archetype>();
+  queryEraseNonMember();
+  concurrentQueryRegistration(std::make_index_sequence<8>{});
+  snapshotKeyAndLayout();
+  commandsApplyInKeyOrder();
+  commandsClearedAfterThrow();
+  timeSliceResumesAcrossRuns();
+
+  if (failures == 0)
+    std::printf("All ECS2 tests passed\n");
+  return failures;
+}
@@ -1,5 +1,13 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
 #include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 inline char *loadFileToCstr(const char *path) {
   std::ifstream file(path, std::ios::binary | std::ios::ate);
@@ -15,3 +23,70 @@ inline char *loadFileToCstr(const char *path) {
   buf[size] = '\0';
   return buf;
 }
+
+// Read-only memory mapping of a whole file. Empty if the file could not be
+// opened or mapped.
+class MappedFile {
+public:
+  explicit MappedFile(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+      void *mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size),
+                            PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED) {
+        bytes = static_cast<const std::byte *>(mapped);
+        length = static_cast<size_t>(info.st_size);
+      }
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (bytes)
+      ::munmap(const_cast<std::byte *>(bytes), length);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const std::byte *data() const { return bytes; }
+  size_t size() const { return length; }
+  explicit operator bool() const { return bytes != nullptr; }
+
+private:
+  const std::byte *bytes = nullptr;
+  size_t length = 0;
+};
+
+// 64-bit FNV-1a of size bytes, continuing from seed so several buffers can
+// be hashed as one
+inline uint64_t hashBytes(const void *data, size_t size,
+                          uint64_t seed = 14695981039346656037ull) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// hashBytes over a file's contents. A missing or empty file adds nothing.
+inline uint64_t hashFile(const char *path,
+                         uint64_t seed = 14695981039346656037ull) {
+  MappedFile file(path);
+  return file ? hashBytes(file.data(), file.size(), seed) : seed;
+}
+
+// Per-user directory for files that can be rebuilt at any time:
+// $XDG_CACHE_HOME/strawberry, else ~/.cache/strawberry. Empty if neither
+// variable is set.
+inline std::filesystem::path userCacheDir() {
+  if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    return std::filesystem::path(xdg) / "strawberry";
+  if (const char *home = std::getenv("HOME"); home && *home)
+    return std::filesystem::path(home) / ".cache" / "strawberry";
+  return {};
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+// Bump allocator for memory that only lives until the end of the frame.
+// Allocation moves a pointer forward, deallocation does nothing and reset()
+// hands everything back at once. Blocks are kept across resets, so once the
+// arena has grown to a frame's peak the frame loop never touches the heap.
+//
+// It is a std::pmr::memory_resource, so transient containers can use it
+// directly: std::pmr::vector<T> list(&arena). Nothing allocated from it may
+// be used after reset(). Not thread safe; use one arena per thread.
+class FrameArena : public std::pmr::memory_resource {
+public:
+  static constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+  // hugePages backs blocks with transparent huge pages where the platform
+  // supports them, which cuts TLB misses for large per-frame buffers
+  explicit FrameArena(size_t blockSize = size_t(1) << 20,
+                      bool hugePages = false)
+      : blockSize(blockSize), hugePages(hugePages) {}
+
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  ~FrameArena() override {
+    for (const Block &block : blocks) {
+      release(block);
+    }
+  }
+
+  // Starts a new frame. If the last frame spilled into more than one block
+  // they are merged into one block that fits it, so the next frame stays
+  // in a single contiguous range.
+  void reset() {
+    peak = std::max(peak, used());
+    if (blocks.size() > 1) {
+      size_t total = 0;
+      for (const Block &block : blocks) {
+        total += block.size;
+        release(block);
+      }
+      blocks.clear();
+      blocks.push_back(acquire(total));
+    }
+    current = 0;
+    offset = 0;
+    spilled = 0;
+  }
+
+  // Bytes handed out since the last reset, alignment padding included
+  size_t used() const { return spilled + offset; }
+  // Largest used() seen at a reset
+  size_t highWater() const { return peak; }
+
+  size_t capacity() const {
+    size_t total = 0;
+    for (const Block &block : blocks)
+      total += block.size;
+    return total;
+  }
+
+  template <typename T> T *allocateArray(size_t count) {
+    return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+protected:
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    while (current < blocks.size()) {
+      Block &block = blocks[current];
+      size_t start = alignUp(reinterpret_cast<uintptr_t>(block.data) + offset,
+                             alignment) -
+                     reinterpret_cast<uintptr_t>(block.data);
+      if (start + bytes <= block.size) {
+        offset = start + bytes;
+        return block.data + start;
+      }
+      // Blocks after the current one are free; move on to the next
+      spilled += offset;
+      current++;
+      offset = 0;
+    }
+    blocks.push_back(acquire(std::max(blockSize, bytes + alignment)));
+    return do_allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *, size_t, size_t) override {}
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+private:
+  struct Block {
+    std::byte *data;
+    size_t size;
+    bool mapped; // From mmap rather than operator new
+  };
+
+  static constexpr size_t BLOCK_ALIGN = 64;
+
+  static uintptr_t alignUp(uintptr_t value, size_t alignment) {
+    return (value + alignment - 1) & ~uintptr_t(alignment - 1);
+  }
+
+  Block acquire(size_t size) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (hugePages) {
+      size = alignUp(size, HUGE_PAGE_SIZE);
+      void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p != MAP_FAILED) {
+        // Only a hint; the kernel falls back to normal pages if it must
+        madvise(p, size, MADV_HUGEPAGE);
+        return {static_cast<std::byte *>(p), size, true};
+      }
+    }
+#endif
+    size = alignUp(size, BLOCK_ALIGN);
+    return {static_cast<std::byte *>(
+                ::operator new(size, std::align_val_t{BLOCK_ALIGN})),
+            size, false};
+  }
+
+  static void release(const Block &block) {
+#if defined(__linux__)
+    if (block.mapped) {
+      munmap(block.data, block.size);
+      return;
+    }
+#endif
+    ::operator delete(block.data, std::align_val_t{BLOCK_ALIGN});
+  }
+
+  size_t blockSize;
+  bool hugePages;
+  std::vector<Block> blocks;
+  size_t current = 0; // Block being bumped
+  size_t offset = 0;  // Next free byte in blocks[current]
+  size_t spilled = 0; // Bytes used in blocks before current
+  size_t peak = 0;
+};